@@ -0,0 +1,329 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <getopt.h>
+    #include <poll.h>
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <string.h>
+    #include <time.h>
+    #include <unistd.h>
+    #include "config.h"
+
+    // fizmo includes...
+    #include <interpreter/fizmo.h>
+
+    // jansson...
+    #include <jansson.h>
+}
+
+#include "screen.h"
+#include "story.h"
+#include "transport.h"
+#include "util.h"
+#include "zygote.h"
+
+const char *usageFmt = R"(
+OVERVIEW: %1$s, runs fizmo-json command scripts in parallel.
+
+USAGE: %1$s [options] <manifest>
+
+OPTIONS:
+  -h, --help                  this list
+  -V, --version               version of %1$s
+  -j, --jobs <count>          number of jobs to run at once (all cores)
+  -o, --output-dir <dir>      where to write outputs that the manifest
+                              doesn't name (.)
+  -t, --trace-level <level>   trace level for stderr
+
+and <manifest> is a file with one JSON job per line, like:
+
+  { "story": "curses.z5", "commands": ["look", "inventory"], "output": "a.ndjson" }
+
+Each job's commands (which can't contain line breaks) are fed to a fresh
+session of its story, one per turn, and every frame of output is written to
+the job's own newline-delimited JSON file (by default "job-<line>.ndjson").
+A job ends when it runs out of commands or the story ends.
+
+)";
+
+
+void usage(int exit_code) {
+    fprintf(stderr, usageFmt, PACKAGE_NAME "-batch");
+    exit(exit_code);
+}
+
+
+struct Job {
+    int         line;
+    std::string story;
+    std::string commands;   // newline-separated, exactly as a console would type them
+    std::string output;
+};
+
+
+static bool load_manifest(const char *path, const std::string &outputDir, std::vector<Job> &jobs) {
+    trace(1, "%s", path);
+
+    FILE *manifest = fopen(path, "r");
+    if (!manifest) {
+        fprintf(stderr, "ERROR: unable to open manifest %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    int lineNumber = 0;
+    bool ok = true;
+
+    while (ok && getline(&line, &size, manifest) >= 0) {
+        ++lineNumber;
+
+        if (line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+
+        json_error_t error;
+        json_t *obj = json_loads(line, 0, &error);
+
+        const char *story = json_string_value(json_object_get(obj, "story"));
+        json_t *commands = json_object_get(obj, "commands");
+        if (!story || !json_is_array(commands)) {
+            fprintf(stderr, "ERROR: %s:%d: expected \"story\" and \"commands\"\n", path, lineNumber);
+            ok = false;
+        } else {
+            Job job = { lineNumber, story, "", "" };
+
+            // A line break inside a command would make it two commands.
+            size_t i;
+            json_t *command;
+            json_array_foreach(commands, i, command) {
+                const char *text = json_string_value(command);
+                if (text && strpbrk(text, "\r\n")) {
+                    fprintf(stderr, "ERROR: %s:%d: command %d contains a line break\n", path, lineNumber, (int)i + 1);
+                    ok = false;
+                    break;
+                }
+                job.commands += text ? text : "";
+                job.commands += '\n';
+            }
+
+            const char *output = json_string_value(json_object_get(obj, "output"));
+            job.output = output ? output : outputDir + "/job-" + std::to_string(lineNumber) + ".ndjson";
+
+            if (ok) {
+                jobs.push_back(job);
+            }
+        }
+
+        json_decref(obj);
+    }
+
+    free(line);
+    fclose(manifest);
+    return ok;
+}
+
+
+// Each job reads its commands from a temporary file, and writes its output
+// straight to its own file.  The third descriptor is a "lifeline": the job
+// never touches it, but when the job exits its end closes, which is how we
+// know the job is done.
+static void batch_session_setup(json_t *request, const int *fds, int nfds) {
+    trace(1, "%p, %d", request, nfds);
+
+    if (nfds < 3) {
+        fprintf(stderr, "ERROR: job spawned without its descriptors\n");
+        _exit(1);
+    }
+
+    screen_set_transport(new FdTransport(fds[0], fds[1], true));
+}
+
+// Starts a job, returning the read end of its lifeline (or -1).
+static int start_job(Preloader *preloader, const Job &job) {
+    trace(1, "%d: %s -> %s", job.line, job.story.c_str(), job.output.c_str());
+
+    FILE *commands = tmpfile();
+    if (!commands) {
+        fprintf(stderr, "ERROR: unable to create command file: %s\n", strerror(errno));
+        return -1;
+    }
+    fwrite(job.commands.data(), 1, job.commands.size(), commands);
+    fflush(commands);
+    rewind(commands);
+
+    int fds[3];
+    int lifeline[2];
+    fds[0] = dup(fileno(commands));
+    fclose(commands);
+    fds[1] = open(job.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fds[1] < 0) {
+        fprintf(stderr, "ERROR: unable to open %s: %s\n", job.output.c_str(), strerror(errno));
+        close(fds[0]);
+        return -1;
+    }
+    if (pipe2(lifeline, O_CLOEXEC) < 0) {
+        fprintf(stderr, "ERROR: unable to create pipe: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    fds[2] = lifeline[1];
+
+    json_t *request = json_object();
+    json_object_set_new(request, "job", json_integer(job.line));
+    bool spawned = preloader->Spawn(request, fds, 3);
+    json_decref(request);
+
+    for (int fd : fds) {
+        close(fd);
+    }
+
+    if (!spawned) {
+        close(lifeline[0]);
+        return -1;
+    }
+
+    return lifeline[0];
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    static struct option long_options[] = {
+        { "version",     no_argument,       NULL, 'V' },
+        { "help",        no_argument,       NULL, 'h' },
+        { "jobs",        required_argument, NULL, 'j' },
+        { "output-dir",  required_argument, NULL, 'o' },
+        { "trace-level", required_argument, NULL, 't' },
+        { NULL,          0,                 NULL, 0 }
+    };
+
+    long parallel = sysconf(_SC_NPROCESSORS_ONLN);
+    std::string outputDir = ".";
+
+    int ch;
+    while ((ch = getopt_long(argc, argv, "Vhj:o:t:", long_options, NULL)) != -1) {
+        switch (ch) {
+
+            case 'V':
+                fprintf(stderr, "%s-batch %s (using libfizmo %s)\n", PACKAGE_NAME, PACKAGE_VERSION, LIBFIZMO_VERSION);
+                exit(0);
+                break;
+
+            case 'h':
+                usage(0);
+                break;
+
+            case 'j':
+                parallel = atoi(optarg);
+                break;
+
+            case 'o':
+                outputDir = optarg;
+                break;
+
+            case 't':
+                set_trace_level(atoi(optarg));
+                break;
+
+            default:
+                usage(-1);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1) {
+        fprintf(stderr, "No manifest provided!\n");
+        usage(-2);
+    }
+
+    if (parallel < 1) {
+        parallel = 1;
+    }
+
+    std::vector<Job> jobs;
+    if (!load_manifest(argv[0], outputDir, jobs)) {
+        return 1;
+    }
+
+    // Jobs feed their commands as plain lines; there's no JSON to parse on
+    // the way in.
+    story_init("");
+    screen_use_simple_console_input();
+
+    // One preloader per story, so every job forks from an already-loaded
+    // story rather than starting cold.
+    std::map<std::string, Preloader *> preloaders;
+    for (const auto &job : jobs) {
+        if (preloaders.count(job.story)) {
+            continue;
+        }
+        auto preloader = new Preloader(job.story);
+        if (!preloader->Start(&batch_session_setup)) {
+            return 1;
+        }
+        preloaders[job.story] = preloader;
+    }
+
+    const double start = now();
+    size_t next = 0;
+    int failed = 0;
+    std::vector<struct pollfd> running;
+
+    while (next < jobs.size() || !running.empty()) {
+        while (next < jobs.size() && running.size() < (size_t)parallel) {
+            const Job &job = jobs[next++];
+            int lifeline = start_job(preloaders[job.story], job);
+            if (lifeline < 0) {
+                ++failed;
+                continue;
+            }
+            running.push_back({ lifeline, POLLIN, 0 });
+        }
+
+        if (running.empty()) {
+            continue;
+        }
+
+        if (poll(running.data(), running.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: poll failed: %s\n", strerror(errno));
+            return 1;
+        }
+
+        for (auto p = running.begin(); p != running.end(); ) {
+            if (p->revents) {
+                close(p->fd);
+                p = running.erase(p);
+            } else {
+                ++p;
+            }
+        }
+    }
+
+    const double elapsed = now() - start;
+    fprintf(stderr, "%zu jobs (%d failed to start) in %.3fs: %.1f jobs/s\n",
+        jobs.size(), failed, elapsed, elapsed > 0 ? jobs.size() / elapsed : 0.0);
+
+    for (auto &p : preloaders) {
+        delete p.second;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -2,6 +2,8 @@
 
 #include "buffer.h"
 
+#include <iterator>
+
 extern "C" {
     #include <interpreter/fizmo.h>
     // #include <jansson.h>
@@ -9,18 +11,38 @@ extern "C" {
 
 #include "screen.h"
 #include "format.h"
+#include "paragraphrefs.h"
+#include "serialize.h"
 #include "util.h"
 
 
 Buffer::Buffer() {
     trace(2, "%p", this);
     lastParagraphOpen_ = false;
+    bytes_ = 0;
+    limit_ = 0;
+    truncated_ = false;
 }
 
 void Buffer::Empty() {
     trace(2, "%p", this);
     paragraphs_.clear();
     lastParagraphOpen_ = false;
+    bytes_ = 0;
+    truncated_ = false;
+}
+
+size_t Buffer::Bytes() const {
+    return bytes_;
+}
+
+void Buffer::SetLimit(size_t limit) {
+    trace(1, "%p, %d", this, limit);
+    limit_ = limit;
+}
+
+bool Buffer::Truncated() const {
+    return truncated_;
 }
 
 void Buffer::Append(const struct blockbuf_char& bbch) {
@@ -31,8 +53,13 @@ void Buffer::Append(const struct blockbuf_char& bbch) {
      if (last == NULL || !lastParagraphOpen_) {
         paragraphs_.emplace_back(bbch);
         lastParagraphOpen_ = true;
-    } else if (!last->Append(bbch)) {
-        lastParagraphOpen_ = false;
+        bytes_ += paragraphs_.back().Bytes();
+    } else {
+        size_t before = last->Bytes();
+        if (!last->Append(bbch)) {
+            lastParagraphOpen_ = false;
+        }
+        bytes_ += last->Bytes() - before;
     }
 }
 
@@ -65,10 +92,32 @@ void Buffer::Append(const std::string &str, const Format &format) {
 void Buffer::AppendSafe(const std::string &str, const Format &format, bool leaveParagraphOpen) {
     trace(2, "\"%s\"", str.c_str());
 
+    if (truncated_) {
+        return;
+    }
+
+    if (limit_ && bytes_ + str.size() > limit_) {
+        // Keep what fits (without splitting a UTF-8 sequence), and drop the
+        // rest of the turn's text.
+        size_t keep = bytes_ < limit_ ? limit_ - bytes_ : 0;
+        while (keep > 0 && (str[keep] & 0xC0) == 0x80) {
+            --keep;
+        }
+        tracex(1, "buffer limit of %d bytes reached, truncating", limit_);
+        if (keep > 0) {
+            AppendSafe(str.substr(0, keep), format, true);
+        }
+        truncated_ = true;
+        return;
+    }
+
     if (lastParagraphOpen_ && !paragraphs_.empty()) {
+        size_t before = paragraphs_.back().Bytes();
         paragraphs_.back().Append(str, format);
+        bytes_ += paragraphs_.back().Bytes() - before;
     } else {
         paragraphs_.emplace_back(str, format);
+        bytes_ += paragraphs_.back().Bytes();
     }
 
     tracex(3, "********");
@@ -85,24 +134,64 @@ void Buffer::Prepend(const Buffer &buffer) {
     for (auto it = buffer.paragraphs_.crbegin(); it != buffer.paragraphs_.crend(); it++) {
         paragraphs_.push_front(*it);
     }
+    bytes_ += buffer.bytes_;
 }
 
-json_t* Buffer::ToJson(bool skipLeadingBlanks, bool omitPrompt) const {
-    json_t *obj = json_array();
+size_t Buffer::CompleteParagraphs() const {
+    return paragraphs_.size() - (lastParagraphOpen_ ? 1 : 0);
+}
 
-    if (paragraphs_.empty()) {
-        return obj;
+size_t Buffer::TakeComplete(Buffer &buffer) {
+    trace(2, "%p, %p", this, &buffer);
+
+    auto end = paragraphs_.end();
+    if (lastParagraphOpen_ && end != paragraphs_.begin()) {
+        --end;
     }
+    while (end != paragraphs_.begin() && std::prev(end)->IsEmpty()) {
+        --end;
+    }
+
+    size_t count = 0;
+    size_t bytes = 0;
+    for (auto it = paragraphs_.begin(); it != end; ++it) {
+        bytes += it->Bytes();
+        ++count;
+    }
+
+    buffer.paragraphs_.splice(buffer.paragraphs_.end(), paragraphs_, paragraphs_.begin(), end);
+    buffer.lastParagraphOpen_ = false;
+    buffer.bytes_ += bytes;
+    bytes_ -= bytes < bytes_ ? bytes : bytes_;
+    return count;
+}
+
+void Buffer::Range(bool skipLeadingBlanks, bool omitPrompt, bool continued, Iterator &start, Iterator &end) const {
+    start = paragraphs_.cbegin();
+    end = paragraphs_.cend();
 
-    auto start = paragraphs_.cbegin();
-    auto end = paragraphs_.cend();
+    if (paragraphs_.empty()) {
+        return;
+    }
 
     if (skipLeadingBlanks) {
-        while (start->IsEmpty() && start != end) {
+        while (start != end && start->IsEmpty()) {
             ++start;
         }
     }
 
+    // The turn's earlier paragraphs have been sent, so there's no need to
+    // keep a lone prompt (or blank) just to have something to show.
+    if (continued) {
+        if (end != start && omitPrompt && lastParagraphOpen_) {
+            --end;
+        }
+        while (end != start && std::prev(end)->IsEmpty()) {
+            --end;
+        }
+        return;
+    }
+
     if (end != start && omitPrompt && lastParagraphOpen_) {
         --end;      // pointing at last, open paragraph
         if (end != start) {
@@ -110,13 +199,22 @@ json_t* Buffer::ToJson(bool skipLeadingBlanks, bool omitPrompt) const {
         }
     }
 
-    while (end != start && end->IsEmpty()) {
+    // (Only once `end` points at a real paragraph is there anything to trim.)
+    while (end != start && end != paragraphs_.cend() && end->IsEmpty()) {
         --end;
     }
 
     if (end != paragraphs_.cend()) {
         ++end;
     }
+}
+
+json_t* Buffer::ToJson(bool skipLeadingBlanks, bool omitPrompt) const {
+    json_t *obj = json_array();
+
+    Iterator start;
+    Iterator end;
+    Range(skipLeadingBlanks, omitPrompt, false, start, end);
 
     for (auto p = start; p != end; ++p) {
         json_array_append_new(obj, p->ToJson());
@@ -125,6 +223,52 @@ json_t* Buffer::ToJson(bool skipLeadingBlanks, bool omitPrompt) const {
     return obj;
 }
 
+void Buffer::WriteJson(DocWriter &writer, bool skipLeadingBlanks, bool omitPrompt, ParagraphRefs *refs, bool continued) const {
+    Iterator start;
+    Iterator end;
+    Range(skipLeadingBlanks, omitPrompt, continued, start, end);
+
+    writer.BeginArray();
+    for (auto p = start; p != end; ++p) {
+        if (refs) {
+            refs->WriteJson(writer, *p);
+        } else {
+            p->WriteJson(writer);
+        }
+    }
+    writer.EndArray();
+}
+
+const std::list<Paragraph> &Buffer::Paragraphs() const {
+    return paragraphs_;
+}
+
+void Buffer::Save(std::ostream &os) const {
+    SaveValue(os, lastParagraphOpen_);
+    SaveValue(os, (uint32_t)paragraphs_.size());
+    for (const auto &p : paragraphs_) {
+        p.Save(os);
+    }
+}
+
+bool Buffer::Load(std::istream &is) {
+    uint32_t count;
+    if (!LoadValue(is, lastParagraphOpen_) || !LoadValue(is, count)) {
+        return false;
+    }
+
+    paragraphs_.clear();
+    bytes_ = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        paragraphs_.emplace_back();
+        if (!paragraphs_.back().Load(is)) {
+            return false;
+        }
+        bytes_ += paragraphs_.back().Bytes();
+    }
+    return true;
+}
+
 std::ostream & operator<<(std::ostream &os, const Buffer& buffer) {
     os << "<buffer:\n";
     for (const auto &paragraph : buffer.paragraphs_) {
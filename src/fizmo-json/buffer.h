@@ -13,6 +13,7 @@ extern "C" {
 #include "paragraph.h"
 #include "format.h"
 
+class ParagraphRefs;
 
 class Buffer {
   public:
@@ -26,7 +27,36 @@ class Buffer {
 
     void Prepend(const Buffer &buffer);
 
+    // The number of complete paragraphs (all but one still being added to).
+    size_t CompleteParagraphs() const;
+
+    // Moves the complete paragraphs onto the end of `buffer`, leaving the one
+    // still being added to (if any), and any blank ones just before it so
+    // that WriteJson() can still trim them.  Returns the number moved.
+    size_t TakeComplete(Buffer &buffer);
+
     json_t* ToJson(bool skipLeadingBlanks = false, bool omitPrompt = false) const;
+    // With `refs`, paragraphs the client already has are written as
+    // references (see paragraphrefs.h).  `continued` is for what's left of a
+    // turn after TakeComplete(): the prompt and the blanks before it are
+    // always trimmed, even when that leaves nothing at all.
+    void WriteJson(DocWriter &writer, bool skipLeadingBlanks = false, bool omitPrompt = false, ParagraphRefs *refs = NULL, bool continued = false) const;
+
+    const std::list<Paragraph> &Paragraphs() const;
+
+    // The size of the (UTF-8) text held by the buffer's paragraphs, kept up to
+    // date as text is added.
+    size_t Bytes() const;
+
+    // Caps the text appended to the buffer at `limit` bytes, or
+    // zero for no cap.  Text past the cap is dropped, and the buffer reports
+    // itself as truncated until it's next emptied.
+    void SetLimit(size_t limit);
+    bool Truncated() const;
+
+    // Snapshot support...
+    void Save(std::ostream &os) const;
+    bool Load(std::istream &is);
 
     // Debugging helper?  Do we like this, or is the operator overload
     // obnoxious?
@@ -34,10 +64,18 @@ class Buffer {
 
 
   private:
+    typedef std::list<Paragraph>::const_iterator Iterator;
+
+    // The paragraphs that ToJson() and WriteJson() include.
+    void Range(bool skipLeadingBlanks, bool omitPrompt, bool continued, Iterator &start, Iterator &end) const;
+
     void AppendSafe(const std::string &str, const Format &format, bool leaveParagraphOpen);
 
     std::list<Paragraph>    paragraphs_;
     bool                    lastParagraphOpen_;
+    size_t                  bytes_;
+    size_t                  limit_;
+    bool                    truncated_;
 };
 
 
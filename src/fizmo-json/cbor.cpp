@@ -0,0 +1,362 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "cbor.h"
+
+#include <cstdint>
+
+extern "C" {
+    #include <math.h>
+    #include <string.h>
+}
+
+#include "util.h"
+
+
+// Major types...
+static const unsigned char CBOR_UINT    = 0;
+static const unsigned char CBOR_NEGINT  = 1;
+static const unsigned char CBOR_BYTES   = 2;
+static const unsigned char CBOR_TEXT    = 3;
+static const unsigned char CBOR_ARRAY   = 4;
+static const unsigned char CBOR_MAP     = 5;
+static const unsigned char CBOR_TAG     = 6;
+static const unsigned char CBOR_SIMPLE  = 7;
+
+// ... and the additional-information values that aren't lengths.
+static const unsigned char CBOR_INDEFINITE = 31;
+static const unsigned char CBOR_BREAK   = 0xFF;
+
+static const unsigned char CBOR_FALSE   = 0xF4;
+static const unsigned char CBOR_TRUE    = 0xF5;
+static const unsigned char CBOR_NULL    = 0xF6;
+static const unsigned char CBOR_DOUBLE  = 0xFB;
+
+// Nesting deeper than this in input is rejected, rather than risk the stack.
+static const int MAX_DEPTH = 64;
+
+
+CborWriter::CborWriter() {
+    trace(2, "[%p]", this);
+}
+
+void CborWriter::Reset() {
+    out_.clear();
+}
+
+const std::string &CborWriter::Str() const {
+    return out_;
+}
+
+// Writes an item's initial byte, and its argument in the fewest bytes.
+void CborWriter::Head(unsigned char major, uint64_t value) {
+    major <<= 5;
+
+    if (value < 24) {
+        out_ += (char)(major | value);
+        return;
+    }
+
+    int bytes;
+    if (value <= 0xFF) {
+        out_ += (char)(major | 24);
+        bytes = 1;
+    } else if (value <= 0xFFFF) {
+        out_ += (char)(major | 25);
+        bytes = 2;
+    } else if (value <= 0xFFFFFFFF) {
+        out_ += (char)(major | 26);
+        bytes = 4;
+    } else {
+        out_ += (char)(major | 27);
+        bytes = 8;
+    }
+
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+        out_ += (char)((value >> shift) & 0xFF);
+    }
+}
+
+void CborWriter::BeginObject() {
+    out_ += (char)((CBOR_MAP << 5) | CBOR_INDEFINITE);
+}
+
+void CborWriter::EndObject() {
+    out_ += (char)CBOR_BREAK;
+}
+
+void CborWriter::BeginArray() {
+    out_ += (char)((CBOR_ARRAY << 5) | CBOR_INDEFINITE);
+}
+
+void CborWriter::EndArray() {
+    out_ += (char)CBOR_BREAK;
+}
+
+void CborWriter::Key(const char *key) {
+    String(key, strlen(key));
+}
+
+void CborWriter::String(const char *str, size_t len) {
+    Head(CBOR_TEXT, len);
+    out_.append(str, len);
+}
+
+void CborWriter::Integer(long long value) {
+    if (value >= 0) {
+        Head(CBOR_UINT, value);
+    } else {
+        Head(CBOR_NEGINT, (uint64_t)(-(value + 1)));
+    }
+}
+
+void CborWriter::Real(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    out_ += (char)CBOR_DOUBLE;
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        out_ += (char)((bits >> shift) & 0xFF);
+    }
+}
+
+void CborWriter::Bool(bool value) {
+    out_ += (char)(value ? CBOR_TRUE : CBOR_FALSE);
+}
+
+void CborWriter::Null() {
+    out_ += (char)CBOR_NULL;
+}
+
+
+// A small recursive-descent decoder over the bytes of one message.
+class CborReader {
+  public:
+    CborReader(const std::string &bytes)
+    : p_((const unsigned char *)bytes.data()), end_(p_ + bytes.size()) {
+    }
+
+    json_t *Read(std::string &error) {
+        json_t *value = Item(0);
+        if (value && p_ != end_) {
+            json_decref(value);
+            value = NULL;
+            error_ = "trailing bytes after the message";
+        }
+        error = error_;
+        return value;
+    }
+
+  private:
+    bool Fail(const char *error) {
+        if (error_.empty()) {
+            error_ = error;
+        }
+        return false;
+    }
+
+    bool Byte(unsigned char &byte) {
+        if (p_ >= end_) {
+            return Fail("unexpected end of message");
+        }
+        byte = *p_++;
+        return true;
+    }
+
+    // Reads the argument that follows an initial byte.
+    bool Argument(unsigned char info, uint64_t &value) {
+        if (info < 24) {
+            value = info;
+            return true;
+        }
+
+        int bytes;
+        switch (info) {
+            case 24: bytes = 1; break;
+            case 25: bytes = 2; break;
+            case 26: bytes = 4; break;
+            case 27: bytes = 8; break;
+            default: return Fail("malformed item");
+        }
+
+        value = 0;
+        for (int i = 0; i < bytes; i++) {
+            unsigned char byte;
+            if (!Byte(byte)) {
+                return false;
+            }
+            value = (value << 8) | byte;
+        }
+        return true;
+    }
+
+    bool AtBreak() {
+        if (p_ < end_ && *p_ == CBOR_BREAK) {
+            ++p_;
+            return true;
+        }
+        return false;
+    }
+
+    // Text (or byte) strings, including indefinite-length ones made of
+    // definite-length chunks of the same type.
+    bool Chars(unsigned char major, unsigned char info, std::string &str) {
+        if (info == CBOR_INDEFINITE) {
+            while (!AtBreak()) {
+                unsigned char initial;
+                if (!Byte(initial) || (initial >> 5) != major || (initial & 0x1F) == CBOR_INDEFINITE) {
+                    return Fail("malformed string chunk");
+                }
+                if (!Chars(major, initial & 0x1F, str)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        uint64_t len;
+        if (!Argument(info, len)) {
+            return false;
+        }
+        if (len > (uint64_t)(end_ - p_)) {
+            return Fail("string runs past the end of the message");
+        }
+        str.append((const char *)p_, len);
+        p_ += len;
+        return true;
+    }
+
+    static double HalfToDouble(uint16_t half) {
+        int exponent = (half >> 10) & 0x1F;
+        int mantissa = half & 0x3FF;
+        double value;
+        if (exponent == 0) {
+            value = ldexp(mantissa, -24);
+        } else if (exponent != 31) {
+            value = ldexp(mantissa + 1024, exponent - 25);
+        } else {
+            value = mantissa == 0 ? INFINITY : NAN;
+        }
+        return (half & 0x8000) ? -value : value;
+    }
+
+    json_t *Item(int depth) {
+        if (depth > MAX_DEPTH) {
+            Fail("nested too deeply");
+            return NULL;
+        }
+
+        unsigned char initial;
+        if (!Byte(initial)) {
+            return NULL;
+        }
+
+        const unsigned char major = initial >> 5;
+        const unsigned char info = initial & 0x1F;
+        uint64_t arg = 0;
+
+        // Strings read their own lengths, and indefinite-length containers
+        // don't have one.
+        const bool container = major == CBOR_ARRAY || major == CBOR_MAP;
+        if (major != CBOR_BYTES && major != CBOR_TEXT && !(container && info == CBOR_INDEFINITE)) {
+            if (!Argument(info, arg)) {
+                return NULL;
+            }
+        }
+
+        switch (major) {
+            case CBOR_UINT:
+                return json_integer((json_int_t)arg);
+
+            case CBOR_NEGINT:
+                return json_integer(-1 - (json_int_t)arg);
+
+            case CBOR_BYTES:
+            case CBOR_TEXT: {
+                std::string str;
+                if (!Chars(major, info, str)) {
+                    return NULL;
+                }
+                json_t *value = json_stringn(str.data(), str.size());
+                if (!value) {
+                    Fail("string isn't valid UTF-8");
+                }
+                return value;
+            }
+
+            case CBOR_ARRAY: {
+                json_t *array = json_array();
+                for (uint64_t i = 0; info == CBOR_INDEFINITE ? !AtBreak() : i < arg; i++) {
+                    json_t *element = Item(depth + 1);
+                    if (!element) {
+                        json_decref(array);
+                        return NULL;
+                    }
+                    json_array_append_new(array, element);
+                }
+                return array;
+            }
+
+            case CBOR_MAP: {
+                json_t *object = json_object();
+                for (uint64_t i = 0; info == CBOR_INDEFINITE ? !AtBreak() : i < arg; i++) {
+                    json_t *key = Item(depth + 1);
+                    if (!key || !json_is_string(key)) {
+                        Fail("map key isn't a string");
+                        json_decref(key);
+                        json_decref(object);
+                        return NULL;
+                    }
+
+                    json_t *member = Item(depth + 1);
+                    if (!member) {
+                        json_decref(key);
+                        json_decref(object);
+                        return NULL;
+                    }
+                    json_object_set_new(object, json_string_value(key), member);
+                    json_decref(key);
+                }
+                return object;
+            }
+
+            case CBOR_TAG:
+                // Tags don't change the JSON equivalent; use what's tagged.
+                return Item(depth + 1);
+
+            case CBOR_SIMPLE:
+                switch (info) {
+                    case 20:    return json_false();
+                    case 21:    return json_true();
+                    case 22:    return json_null();
+                    case 23:    return json_null();     // undefined
+                    case 25:    return json_real(HalfToDouble((uint16_t)arg));
+                    case 26: {
+                        uint32_t bits = (uint32_t)arg;
+                        float value;
+                        memcpy(&value, &bits, sizeof(value));
+                        return json_real(value);
+                    }
+                    case 27: {
+                        double value;
+                        memcpy(&value, &arg, sizeof(value));
+                        return json_real(value);
+                    }
+                }
+                Fail("unsupported simple value");
+                return NULL;
+        }
+
+        Fail("malformed item");
+        return NULL;
+    }
+
+    const unsigned char *p_;
+    const unsigned char *end_;
+    std::string         error_;
+};
+
+json_t *cbor_to_json(const std::string &bytes, std::string &error) {
+    trace(2, "%d bytes", bytes.size());
+    CborReader reader(bytes);
+    return reader.Read(error);
+}
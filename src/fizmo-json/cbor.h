@@ -0,0 +1,51 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_CBOR_H
+#define FIZMO_JSON_CBOR_H
+
+#include <string>
+
+extern "C" {
+    #include <jansson.h>
+}
+
+#include "docwriter.h"
+
+
+// Writes the document as CBOR (RFC 8949).  Objects and arrays are streamed
+// as indefinite-length maps and arrays, so nothing has to be counted ahead
+// of time; strings are definite-length text strings.
+class CborWriter : public DocWriter {
+  public:
+    CborWriter();
+
+    // Starts a new document, keeping the buffer's capacity.
+    void Reset();
+
+    void BeginObject() override;
+    void EndObject() override;
+    void BeginArray() override;
+    void EndArray() override;
+
+    using DocWriter::String;
+    void Key(const char *key) override;
+    void String(const char *str, size_t len) override;
+    void Integer(long long value) override;
+    void Real(double value) override;
+    void Bool(bool value) override;
+    void Null() override;
+
+    const std::string &Str() const override;
+
+  private:
+    void Head(unsigned char major, uint64_t value);
+
+    std::string out_;
+};
+
+// Decodes a single CBOR data item into the equivalent jansson value.  Returns
+// NULL, with an explanation in `error`, if the bytes aren't well-formed CBOR
+// (or use something, like a map with non-string keys, that JSON can't hold).
+extern json_t *cbor_to_json(const std::string &bytes, std::string &error);
+
+#endif // FIZMO_JSON_CBOR_H
@@ -21,6 +21,18 @@ json_t *Columns::ToJson() const {
     return obj;
 }
 
+void Columns::WriteJson(DocWriter &writer) const {
+    writer.BeginArray();
+    for (const auto &i : infos_) {
+        i.WriteJson(writer);
+    }
+    writer.EndArray();
+}
+
+const std::list<ColumnInfo> &Columns::Infos() const {
+    return infos_;
+}
+
 void Columns::Infer(const BlockBuf &buf) {
     trace(2, "[%p] %p", this, &buf);
 
@@ -120,6 +132,19 @@ json_t *ColumnInfo::ToJson() const {
     return obj;
 }
 
+void ColumnInfo::WriteJson(DocWriter &writer) const {
+    writer.BeginObject();
+    writer.Key("column");
+    writer.Integer(column_);
+    writer.Key("lines");
+    writer.BeginArray();
+    for (const auto &i : infos_) {
+        i.WriteJson(writer);
+    }
+    writer.EndArray();
+    writer.EndObject();
+}
+
 std::ostream & operator<<(std::ostream &os, const ColumnInfo& info) {
     os << "  <col:" << info.column_ << "\n";
     for (const auto &line : info.infos_) {
@@ -153,6 +178,15 @@ json_t *LineInfo::ToJson() const {
     return obj;
 }
 
+void LineInfo::WriteJson(DocWriter &writer) const {
+    writer.BeginObject();
+    writer.Key("line");
+    writer.Integer(line_);
+    writer.Key("text");
+    text_.WriteJson(writer);
+    writer.EndObject();
+}
+
 std::ostream & operator<<(std::ostream &os, const LineInfo& info) {
     os << "    <line:" << info.line_ << info.text_ << ">\n";
     return os;
@@ -22,6 +22,9 @@ class Columns {
     Columns(const BlockBuf &buf);
 
     json_t *ToJson() const;
+    void WriteJson(DocWriter &writer) const;
+
+    const std::list<ColumnInfo> &Infos() const;
 
     // Debugging helper?  Do we like this, or is the operator overload
     // obnoxious?
@@ -47,6 +50,7 @@ class ColumnInfo {
     void AddLine(const BlockBuf &buf, int line, int start, int end);
 
     json_t *ToJson() const;
+    void WriteJson(DocWriter &writer) const;
 
     // Debugging helper?  Do we like this, or is the operator overload
     // obnoxious?
@@ -65,6 +69,7 @@ class LineInfo {
     ~LineInfo();
 
     json_t *ToJson() const;
+    void WriteJson(DocWriter &writer) const;
 
     // Debugging helper?  Do we like this, or is the operator overload
     // obnoxious?
@@ -0,0 +1,94 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "compress.h"
+
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+    #include <stdio.h>
+    #include <string.h>
+}
+
+#include "util.h"
+
+
+Deflater::Deflater()
+: initialized_(false) {
+    trace(2, "[%p]", this);
+    memset(&stream_, 0, sizeof(stream_));
+}
+
+Deflater::~Deflater() {
+    trace(2, "[%p]", this);
+    if (initialized_) {
+        deflateEnd(&stream_);
+    }
+}
+
+bool Deflater::Init(int level, const std::string &dictionary) {
+    trace(1, "[%p] %d, %d byte dictionary", this, level, dictionary.size());
+
+    if (deflateInit(&stream_, level) != Z_OK) {
+        fprintf(stderr, "ERROR: unable to start compression: %s\n", stream_.msg ? stream_.msg : "unknown error");
+        return false;
+    }
+    initialized_ = true;
+
+    if (!dictionary.empty() &&
+        deflateSetDictionary(&stream_, (const Bytef *)dictionary.data(), dictionary.size()) != Z_OK) {
+        fprintf(stderr, "ERROR: unable to use compression dictionary\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool Deflater::Compress(const void *data, size_t len, bool flush, std::string &out) {
+    stream_.next_in = (Bytef *)data;
+    stream_.avail_in = len;
+
+    // Deflate into the spare room at the end of `out`, growing it as needed,
+    // until all of the input is consumed (and, when flushing, until deflate()
+    // has room left over, meaning the flush is complete).
+    do {
+        size_t used = out.size();
+        out.resize(used + deflateBound(&stream_, stream_.avail_in) + 16);
+
+        stream_.next_out = (Bytef *)&out[used];
+        stream_.avail_out = out.size() - used;
+
+        int result = deflate(&stream_, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        out.resize(out.size() - stream_.avail_out);
+
+        if (result != Z_OK && result != Z_BUF_ERROR) {
+            fprintf(stderr, "ERROR: compression failed: %s\n", stream_.msg ? stream_.msg : "unknown error");
+            return false;
+        }
+    } while (stream_.avail_in > 0 || (flush && stream_.avail_out == 0));
+
+    return true;
+}
+
+bool compress_load_dictionary(const std::string &path, std::string &dictionary) {
+    trace(1, "%s", path.c_str());
+
+    std::ifstream is(path, std::ios::binary);
+    if (!is) {
+        return false;
+    }
+
+    std::ostringstream contents;
+    contents << is.rdbuf();
+    dictionary = contents.str();
+    return true;
+}
+
+std::string compress_story_dictionary(const std::string &storyfile) {
+    const size_t slash = storyfile.rfind('/');
+    const size_t dot = storyfile.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return storyfile + ".dict";
+    }
+    return storyfile.substr(0, dot) + ".dict";
+}
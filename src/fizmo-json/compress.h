@@ -0,0 +1,47 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_COMPRESS_H
+#define FIZMO_JSON_COMPRESS_H
+
+#include <string>
+
+extern "C" {
+    #include <zlib.h>
+}
+
+
+// A single zlib stream that lasts for the whole session, so that each frame
+// is compressed with everything before it as context (long games repeat the
+// same room descriptions, status lines and parser replies endlessly).  Each
+// frame ends with a sync flush, so the other end can decompress it as soon as
+// it arrives.
+//
+// An optional preset dictionary (trained offline on a story's transcripts)
+// primes the context before the first frame; the stream's header carries the
+// dictionary's Adler-32, and the other end must supply the same dictionary
+// when inflate() asks for it (Z_NEED_DICT).
+class Deflater {
+  public:
+    Deflater();
+    ~Deflater();
+
+    bool Init(int level, const std::string &dictionary);
+
+    // Compresses `len` bytes onto the end of `out`.  When `flush` is set,
+    // everything compressed so far is flushed out as well.
+    bool Compress(const void *data, size_t len, bool flush, std::string &out);
+
+  private:
+    z_stream    stream_;
+    bool        initialized_;
+};
+
+// Reads a dictionary file; returns false if it doesn't exist (or can't be
+// read).
+extern bool compress_load_dictionary(const std::string &path, std::string &dictionary);
+
+// The dictionary that would be bundled with a story: the story's path with
+// its extension replaced by ".dict" (so "curses.z5" has "curses.dict").
+extern std::string compress_story_dictionary(const std::string &storyfile);
+
+#endif // FIZMO_JSON_COMPRESS_H
@@ -0,0 +1,74 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "docwriter.h"
+
+
+DocWriter::DocWriter()
+: schema_(1) {
+}
+
+DocWriter::~DocWriter() {
+}
+
+void DocWriter::SetSchema(int schema) {
+    schema_ = schema;
+}
+
+int DocWriter::Schema() const {
+    return schema_;
+}
+
+void DocWriter::String(const std::string &str) {
+    String(str.data(), str.size());
+}
+
+void DocWriter::Value(json_t *value) {
+    switch (json_typeof(value)) {
+        case JSON_OBJECT: {
+            const char *key;
+            json_t *member;
+            BeginObject();
+            json_object_foreach(value, key, member) {
+                Key(key);
+                Value(member);
+            }
+            EndObject();
+            break;
+        }
+
+        case JSON_ARRAY: {
+            size_t index;
+            json_t *element;
+            BeginArray();
+            json_array_foreach(value, index, element) {
+                Value(element);
+            }
+            EndArray();
+            break;
+        }
+
+        case JSON_STRING:
+            String(json_string_value(value), json_string_length(value));
+            break;
+
+        case JSON_INTEGER:
+            Integer(json_integer_value(value));
+            break;
+
+        case JSON_REAL:
+            Real(json_real_value(value));
+            break;
+
+        case JSON_TRUE:
+            Bool(true);
+            break;
+
+        case JSON_FALSE:
+            Bool(false);
+            break;
+
+        case JSON_NULL:
+            Null();
+            break;
+    }
+}
@@ -0,0 +1,61 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_DOCWRITER_H
+#define FIZMO_JSON_DOCWRITER_H
+
+#include <string>
+
+extern "C" {
+    #include <jansson.h>
+}
+
+
+// Streams a document in the JSON data model (objects, arrays, strings and so
+// on) into a single buffer, in whatever encoding the concrete writer
+// implements: JSON text (jsonwriter.h) or CBOR (cbor.h).  Values are written
+// in order; keys and values alternate inside objects.
+//
+// The writer also carries the output schema the client asked for, which
+// decides how the story classes lay themselves out:
+//
+//   1. every span is { "bold": true, ..., "text": "..." }, and every
+//      paragraph an array of spans (the original schema);
+//   2. a span's style is a single "style" bitmask (reverse 1, bold 2,
+//      italic 4, fixed 8; omitted when zero), and a paragraph without any
+//      styling at all is just its text, as a bare string.
+class DocWriter {
+  public:
+    DocWriter();
+    virtual ~DocWriter();
+
+    void SetSchema(int schema);
+    int Schema() const;
+
+    virtual void BeginObject() = 0;
+    virtual void EndObject() = 0;
+    virtual void BeginArray() = 0;
+    virtual void EndArray() = 0;
+
+    virtual void Key(const char *key) = 0;
+    virtual void String(const char *str, size_t len) = 0;
+    virtual void Integer(long long value) = 0;
+    virtual void Real(double value) = 0;
+    virtual void Bool(bool value) = 0;
+    virtual void Null() = 0;
+
+    void String(const std::string &str);
+
+    // Writes an existing jansson value.
+    void Value(json_t *value);
+
+    // The encoded document.
+    virtual const std::string &Str() const = 0;
+
+  private:
+    int schema_;
+};
+
+// The newest schema this version understands.
+const int MAX_SCHEMA = 2;
+
+#endif // FIZMO_JSON_DOCWRITER_H
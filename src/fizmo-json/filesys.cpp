@@ -55,6 +55,25 @@ z_file* filesys_openfile(char *filename, int filetype, int fileaccess) {
     return result;
 }
 
+z_file *filesys_adopt(FILE *file, const char *filename, int filetype, int fileaccess) {
+    trace(1, "%p, %s, %d, %d", file, filename, filetype, fileaccess);
+
+    z_file *result = (z_file *)fizmo_malloc(sizeof(z_file));
+    if (!result) {
+        fclose(file);
+        return NULL;
+    }
+
+    *result = (z_file) {
+        .file_object = (void *)file,
+        .filename = strdup(filename),
+        .filetype = filetype,
+        .fileaccess = fileaccess,
+    };
+
+    return result;
+}
+
 int filesys_closefile(z_file *file_to_close) {
     trace(1, "%s", file_to_close ? file_to_close->filename : "(NULL)");
 
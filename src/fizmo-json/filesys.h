@@ -5,9 +5,14 @@
 
 
 extern "C" {
+    #include <stdio.h>
     #include <filesys_interface/filesys_interface.h>
 }
 
 extern struct z_filesys_interface bot_filesys;
 
+// Wraps a stdio stream the caller has already opened (and that the z_file
+// then owns), for files that need more care than a plain fopen().
+extern z_file *filesys_adopt(FILE *file, const char *filename, int filetype, int fileaccess);
+
 #endif // FIZMO_JSON_FILESYS_H
@@ -4,22 +4,31 @@ extern "C" {
     // #include <stdio.h>
     #include <stdlib.h>
     #include <getopt.h>
+    #include <string.h>
+    #include <unistd.h>
     #include "config.h"
 
     // fizmo includes...
     #include <interpreter/fizmo.h>
-    #include <interpreter/config.h>
-    #include <tools/filesys.h>  // need this to register filesys... should be better?
 }
 
+#include <vector>
+
+#include "compress.h"
+#include "iothread.h"
 #include "screen.h"
-#include "filesys.h"
+#include "server.h"
+#include "shmring.h"
+#include "story.h"
 #include "util.h"
+#include "zygote.h"
 
 const char *usageFmt = R"(
 OVERVIEW: %1$s, the bot-focused JSON frontend to fizmo.
 
 USAGE: %1$s [options] <storyfile>
+       %1$s [options] --zygote <socket> <storyfile>...
+       %1$s [options] --server <socket> <storyfile>...
 
 OPTIONS:
   -h, --help                  this list
@@ -27,16 +36,139 @@ OPTIONS:
   -c, --console               use simple input, not JSON
   -t, --trace-level <level>   trace level for stderr
   -s, --save-file <filename>  name for auto-save/restore file
+  -z, --zygote <socket>       preload the stories and fork a session for each
+                              connection to the unix-domain <socket>
+  -S, --server <socket>       serve many sessions over the unix-domain <socket>
+  --shm <name>                talk to the host over the shared-memory rings
+                              in the POSIX shared memory object <name>
+  --shm-fd <fd>               likewise, over an inherited (memfd) descriptor
+  --framing <framing>         how frames (and input messages) are delimited on
+                              stdout (and stdin): "ndjson" for one compact
+                              object per line, or "length-prefixed" for a
+                              4-byte big-endian length before each one;
+                              the default is pretty-printed JSON
+  --format <format>           "json" (the default) or "cbor", for both output
+                              frames and input messages; CBOR implies
+                              length-prefixed framing
+  --compress                  deflate (zlib) everything written to stdout as
+                              one continuous stream, flushed after each frame;
+                              implies ndjson framing unless another is given
+  --dictionary <file>         prime the compression with this preset
+                              dictionary (by default, the story's own, like
+                              "curses.dict" for "curses.z5", if there is one)
+  --no-io-thread              do all JSON reading and writing on the
+                              interpreter's own thread
+  --turn-timeout <ms>         give up on a turn (reporting an error, and
+                              exiting) after this much wall-clock time
+  --turn-cpu <ms>             likewise, after this much CPU time
+  --auto-continue[=<regex>]   answer "press any key" pauses automatically, when
+                              the story's latest text matches <regex> (by
+                              default, common prompts like "[MORE]"), folding
+                              their output into the next frame
+  --partial-paragraphs <n>    send story output early, in frames marked
+                              "partial", once this many paragraphs are
+                              complete (the next full frame has the rest,
+                              and the status)
+  --partial-ms <ms>           likewise, once complete paragraphs have waited
+                              this long
+  --buffer-limit <bytes>      once a turn's buffered story output passes this
+                              size, send its complete paragraphs early (as
+                              with --partial-paragraphs) rather than keep them
+  --scrollback <dir>          number every frame ("seq"), and keep them all in
+                              a log per session in <dir>, for "history"
+                              requests
+  --max-output <bytes>        truncate any turn's story output past this size
+  --max-rss <MB>              give up (reporting an error, and exiting) once
+                              the process's memory use passes this
+
+SERVER OPTIONS:
+  --snapshot-dir <dir>        where hibernated sessions are kept (by default,
+                              a new private directory under /tmp)
+  --idle-timeout <seconds>    hibernate sessions idle for this long
+  --max-live <count>          hibernate the least-recently-used sessions
+                              when more than this many are running
+  --min-free <MB>             hibernate the least-recently-used sessions
+                              when less memory than this is available
 
 and <storyfile> is the path to a fizmo-runnable story.
 
+In zygote mode, each connection must first send a single line naming the
+story to play, like:
+
+  { "story": "curses.z5" }
+
+(the name may be omitted when only one story is preloaded), after which the
+connection behaves exactly like a single-story %1$s.
+
+In server mode, every message is a single line of JSON carrying a session id,
+like:
+
+  { "session": "abc", "story": "curses.z5", "input": "look" }
+
+The first message for an unknown session starts it (using "story" to pick
+among the preloaded stories), and every frame of output is a single line
+tagged with the same "session".  A live session can be cloned into a new
+one, which starts out exactly where the original is:
+
+  { "session": "abc", "clone": "xyz" }
+
+Any connection can also watch a session without playing it; every frame the
+session produces is then copied to it as well (until it asks to stop with
+"observe": false, or falls too far behind):
+
+  { "session": "abc", "observe": true }
+
 If you are running this directly from the command-line, be aware that it
 expects JSON-formatted input, like:
 
   { "input": "look" }
 
 unless the `--console` option has been provided; %1$s will wait until
-it reads a complete JSON object before proceeding.
+it reads a complete JSON object before proceeding.  Commands can also be
+sent ahead of time; they're queued, and each is used in turn.  (With `--shm` or
+`--shm-fd`, the messages travel over shared-memory rings instead; see
+shmring.h for the layout.)
+
+Any input message can also ask for a more compact output schema, in which
+a span's style is a single bitmask and an unstyled paragraph is a bare
+string; the next frame confirms the schema in use:
+
+  { "schema": 2, "input": "look" }
+
+Likewise, a client that only uses some of each frame can say which parts it
+wants, out of "story", "status" or just one of its views, "status.columns"
+or "status.lines"; the rest are left out (and not even computed) from then
+on:
+
+  { "want": [ "story" ], "input": "look" }
+
+With "delta": true, each frame's status instead carries a "version", and
+(once the client acknowledges a version it has applied, with "ack") only
+the columns and lines that changed since then; "resync": true asks for the
+full status again.  See statusdelta.h for the details.
+
+  { "ack": 5, "input": "north" }
+
+A client can also keep the story paragraphs it has been sent, and have any
+that come up again (like a room's description) sent as { "ref": <id> }
+instead; "refs" turns this on (true, or how many paragraphs to keep) or off.
+See paragraphrefs.h for the rules both ends follow.
+
+  { "refs": 1024, "input": "look" }
+
+With `--scrollback`, a client that lost track (after reconnecting, say) can
+fetch any range of numbered frames again; they're replayed as they were
+sent, followed by a frame summarizing what was sent and what's available:
+
+  { "history": { "from": 10, "to": 20 } }
+
+Several commands can be sent as one script, which runs them back to back
+and replies with a single frame holding a record ("input", "status" and
+"story") for each, in "outputs"; with "final": true, the reply is just the
+usual frame for the last command.  Output for a command that ends the story
+is marked "ended": true.
+
+  { "inputs": [ "open mailbox", "take leaflet", "read it" ] }
 
 )";
 
@@ -48,7 +180,30 @@ void usage(int exit_code) {
 
 std::string saveFile;
 void set_save_file(const char *file);
-bool set_fizmo_config(const char *key, const char *value);
+
+// Options without a short form...
+enum {
+    OPT_SNAPSHOT_DIR = 256,
+    OPT_IDLE_TIMEOUT,
+    OPT_MAX_LIVE,
+    OPT_MIN_FREE,
+    OPT_SHM,
+    OPT_SHM_FD,
+    OPT_FRAMING,
+    OPT_FORMAT,
+    OPT_NO_IO_THREAD,
+    OPT_TURN_TIMEOUT,
+    OPT_TURN_CPU,
+    OPT_MAX_OUTPUT,
+    OPT_MAX_RSS,
+    OPT_COMPRESS,
+    OPT_DICTIONARY,
+    OPT_AUTO_CONTINUE,
+    OPT_PARTIAL_PARAGRAPHS,
+    OPT_PARTIAL_MS,
+    OPT_BUFFER_LIMIT,
+    OPT_SCROLLBACK,
+};
 
 int main(int argc, char **argv) {
     // trace(1, "%d (%s)", argc, argv[0]);
@@ -61,13 +216,58 @@ int main(int argc, char **argv) {
         { "console",     no_argument,       NULL, 'c' },
         { "trace-level", required_argument, NULL, 't' },
         { "save-file",   required_argument, NULL, 's' },
+        { "zygote",      required_argument, NULL, 'z' },
+        { "server",      required_argument, NULL, 'S' },
+        { "snapshot-dir", required_argument, NULL, OPT_SNAPSHOT_DIR },
+        { "idle-timeout", required_argument, NULL, OPT_IDLE_TIMEOUT },
+        { "max-live",    required_argument, NULL, OPT_MAX_LIVE },
+        { "min-free",    required_argument, NULL, OPT_MIN_FREE },
+        { "shm",         required_argument, NULL, OPT_SHM },
+        { "shm-fd",      required_argument, NULL, OPT_SHM_FD },
+        { "framing",     required_argument, NULL, OPT_FRAMING },
+        { "format",      required_argument, NULL, OPT_FORMAT },
+        { "no-io-thread", no_argument,      NULL, OPT_NO_IO_THREAD },
+        { "turn-timeout", required_argument, NULL, OPT_TURN_TIMEOUT },
+        { "turn-cpu",    required_argument, NULL, OPT_TURN_CPU },
+        { "max-output",  required_argument, NULL, OPT_MAX_OUTPUT },
+        { "max-rss",     required_argument, NULL, OPT_MAX_RSS },
+        { "compress",    no_argument,       NULL, OPT_COMPRESS },
+        { "dictionary",  required_argument, NULL, OPT_DICTIONARY },
+        { "auto-continue", optional_argument, NULL, OPT_AUTO_CONTINUE },
+        { "partial-paragraphs", required_argument, NULL, OPT_PARTIAL_PARAGRAPHS },
+        { "partial-ms",  required_argument, NULL, OPT_PARTIAL_MS },
+        { "buffer-limit", required_argument, NULL, OPT_BUFFER_LIMIT },
+        { "scrollback",  required_argument, NULL, OPT_SCROLLBACK },
         // { "", required_argument, NULL, '' },
         // { "", required_argument, NULL, '' },
         { NULL,          0,                 NULL, 0 }
     };
 
+    const char *zygoteSocket = NULL;
+    const char *serverSocket = NULL;
+    std::string snapshotDir;
+    int idleTimeout = 0;
+    int maxLive = 0;
+    int minFree = 0;
+    bool console = false;
+    bool ioThread = true;
+    bool framed = false;
+    Framing framing = FRAMING_NDJSON;
+    Encoding encoding = ENCODING_JSON;
+    int turnTimeout = 0;
+    int turnCpu = 0;
+    long maxOutput = 0;
+    long maxRss = 0;
+    int partialParagraphs = 0;
+    int partialMs = 0;
+    long bufferLimit = 0;
+    bool compress = false;
+    const char *dictionaryFile = NULL;
+    const char *shmName = NULL;
+    int shmFd = -1;
+
     int ch;
-    while ((ch = getopt_long(argc, argv, "Vhct:s:", long_options, NULL)) != -1) {
+    while ((ch = getopt_long(argc, argv, "Vhct:s:z:S:", long_options, NULL)) != -1) {
         switch (ch) {
 
             case 'V':
@@ -81,6 +281,7 @@ int main(int argc, char **argv) {
 
             case 'c':
                 screen_use_simple_console_input();
+                console = true;
                 break;
 
             case 't':
@@ -91,6 +292,111 @@ int main(int argc, char **argv) {
                 set_save_file(optarg);
                 break;
 
+            case 'z':
+                zygoteSocket = optarg;
+                break;
+
+            case 'S':
+                serverSocket = optarg;
+                break;
+
+            case OPT_SNAPSHOT_DIR:
+                snapshotDir = optarg;
+                break;
+
+            case OPT_IDLE_TIMEOUT:
+                idleTimeout = atoi(optarg);
+                break;
+
+            case OPT_MAX_LIVE:
+                maxLive = atoi(optarg);
+                break;
+
+            case OPT_MIN_FREE:
+                minFree = atoi(optarg);
+                break;
+
+            case OPT_SHM:
+                shmName = optarg;
+                break;
+
+            case OPT_SHM_FD:
+                shmFd = atoi(optarg);
+                break;
+
+            case OPT_FRAMING:
+                framed = true;
+                if (strcmp(optarg, "ndjson") == 0) {
+                    framing = FRAMING_NDJSON;
+                } else if (strcmp(optarg, "length-prefixed") == 0) {
+                    framing = FRAMING_LENGTH_PREFIXED;
+                } else {
+                    fprintf(stderr, "Unknown framing \"%s\"!\n", optarg);
+                    usage(-1);
+                }
+                break;
+
+            case OPT_FORMAT:
+                if (strcmp(optarg, "json") == 0) {
+                    encoding = ENCODING_JSON;
+                } else if (strcmp(optarg, "cbor") == 0) {
+                    encoding = ENCODING_CBOR;
+                } else {
+                    fprintf(stderr, "Unknown format \"%s\"!\n", optarg);
+                    usage(-1);
+                }
+                break;
+
+            case OPT_NO_IO_THREAD:
+                ioThread = false;
+                break;
+
+            case OPT_TURN_TIMEOUT:
+                turnTimeout = atoi(optarg);
+                break;
+
+            case OPT_TURN_CPU:
+                turnCpu = atoi(optarg);
+                break;
+
+            case OPT_MAX_OUTPUT:
+                maxOutput = atol(optarg);
+                break;
+
+            case OPT_MAX_RSS:
+                maxRss = atol(optarg);
+                break;
+
+            case OPT_COMPRESS:
+                compress = true;
+                break;
+
+            case OPT_DICTIONARY:
+                dictionaryFile = optarg;
+                break;
+
+            case OPT_PARTIAL_PARAGRAPHS:
+                partialParagraphs = atoi(optarg);
+                break;
+
+            case OPT_PARTIAL_MS:
+                partialMs = atoi(optarg);
+                break;
+
+            case OPT_BUFFER_LIMIT:
+                bufferLimit = atol(optarg);
+                break;
+
+            case OPT_SCROLLBACK:
+                screen_set_scrollback(optarg);
+                break;
+
+            case OPT_AUTO_CONTINUE:
+                if (!screen_set_auto_continue(optarg)) {
+                    usage(-1);
+                }
+                break;
+
             default:
                 usage(-1);
         }
@@ -105,50 +411,111 @@ int main(int argc, char **argv) {
         tracex(1, "arg %d: \"%s\"", i, argv[i]);
     }
 
-    if (argc != 1) {
+    if (argc < 1 || (argc > 1 && !zygoteSocket && !serverSocket)) {
         fprintf(stderr, "No storyfile provided!\n");
         usage(-2);
     }
 
-    // TODO: implement command-line processing...
-    char *storyfile = argv[0];
-    tracex(1, "using storyfile: %s", storyfile);
+    if ((shmName || shmFd >= 0) && (zygoteSocket || serverSocket)) {
+        fprintf(stderr, "The shared-memory transport is only for single sessions!\n");
+        usage(-2);
+    }
 
-    fizmo_register_filesys_interface(&bot_filesys);
-    tracex(1, "registered filesys");
+    // Binary messages can't be delimited by newlines.
+    if (encoding == ENCODING_CBOR) {
+        if (console || zygoteSocket || serverSocket || (framed && framing != FRAMING_LENGTH_PREFIXED)) {
+            fprintf(stderr, "CBOR is only for single JSON sessions with length-prefixed framing!\n");
+            usage(-2);
+        }
+        framed = true;
+        framing = FRAMING_LENGTH_PREFIXED;
+    }
 
-    // fprintf(stderr, "bot_screen is: %p\n", &bot_screen);
-    int r = fizmo_register_screen_interface(&bot_screen);
-    tracex(1, "register screen result: %d", r);
+    // Compression works on the framed byte stream of a single session.
+    if (compress) {
+        if (console || zygoteSocket || serverSocket || shmName || shmFd >= 0) {
+            fprintf(stderr, "Compression is only for single JSON sessions on stdout!\n");
+            usage(-2);
+        }
+        framed = true;
+    }
 
-    // Set config values...
-    set_fizmo_config("disable-external-streams", config_true_value);
-    set_fizmo_config("disable-restore", config_true_value);
-    set_fizmo_config("disable-save", config_true_value);
-    set_fizmo_config("disable-sound", config_true_value);
+    // Every session would auto-save over every other session's file.
+    if (!saveFile.empty() && (zygoteSocket || serverSocket)) {
+        fprintf(stderr, "The save file is only for single sessions!\n");
+        usage(-2);
+    }
 
-    set_fizmo_config("autosave-filename", saveFile.c_str());
-    // set_configuration_value("savegame-path", ".");
+    story_init(saveFile);
+    screen_set_turn_budget(turnTimeout, turnCpu);
+    screen_set_memory_limits(maxOutput, maxRss);
+    screen_set_partial_output(partialParagraphs, partialMs);
+    screen_set_buffer_limit(bufferLimit);
+    server_set_hibernation(snapshotDir, idleTimeout, maxLive, minFree);
+
+    if (zygoteSocket || serverSocket) {
+        std::vector<std::string> stories(argv, argv + argc);
+        int result = serverSocket ? server_run(serverSocket, stories) : zygote_run(zygoteSocket, stories);
+        return result == 0 ? 0 : 1;
+    }
 
-    // open a test story file...
-    z_file *story = (&bot_filesys)->openfile(storyfile, FILETYPE_DATA, FILEACCESS_READ);
+    // TODO: implement command-line processing...
+    char *storyfile = argv[0];
+    tracex(1, "using storyfile: %s", storyfile);
 
-    z_file *restore = NULL;
-    if (!saveFile.empty()) {
-        restore = (&bot_filesys)->openfile((char*)saveFile.c_str(), FILETYPE_SAVEGAME, FILEACCESS_READ);
+    Transport *transport = NULL;
+    if (shmName || shmFd >= 0) {
+        transport = shmName ? ShmTransport::Open(shmName) : ShmTransport::Adopt(shmFd);
+        if (!transport) {
+            return 1;
+        }
+        if (shmFd >= 0) {
+            close(shmFd);
+        }
+    } else if (framed) {
+        FdTransport *fdTransport = new FdTransport(STDIN_FILENO, STDOUT_FILENO, false, framing);
+        if (compress) {
+            std::string dictionary;
+            if (dictionaryFile) {
+                if (!compress_load_dictionary(dictionaryFile, dictionary)) {
+                    fprintf(stderr, "ERROR: unable to read dictionary \"%s\"\n", dictionaryFile);
+                    return 1;
+                }
+            } else {
+                compress_load_dictionary(compress_story_dictionary(storyfile), dictionary);
+            }
+
+            Deflater *deflater = new Deflater();
+            if (!deflater->Init(Z_DEFAULT_COMPRESSION, dictionary)) {
+                delete deflater;
+                return 1;
+            }
+            fdTransport->SetDeflater(deflater);
+        }
+        transport = fdTransport;
+    } else if (!console) {
+        transport = new StdioTransport();
     }
 
-    fizmo_start(story, NULL, restore);
+    if (transport) {
+        transport->SetEncoding(encoding);
+    }
+
+    // Reading, parsing and writing the JSON happens on an I/O thread, so the
+    // interpreter never waits on a slow consumer (or on parsing) itself.
+    if (transport && !console && ioThread) {
+        transport = new ThreadedTransport(transport);
+    }
+    if (transport) {
+        screen_set_transport(transport);
+    }
+
+    story_run(storyfile, saveFile.empty() ? NULL : saveFile.c_str());
 
     tracex(1, "%s exiting!\n", PACKAGE_NAME);
     return 0;
 }
 
-// cast from const char *, because fizmo uses old-school C...
-bool set_fizmo_config(const char *key, const char *value) {
-    return 0 == set_configuration_value(const_cast<char*>(key), const_cast<char*>(value));
-}
-
 void set_save_file(const char *file) {
     trace(0, "\"%s\"", file);
     saveFile = file;
@@ -10,6 +10,7 @@ extern "C" {
 }
 
 #include "paragraph.h"
+#include "serialize.h"
 #include "util.h"
 
 
@@ -92,6 +93,53 @@ void Format::AddJsonProps(json_t *obj) const {
     set_optional_bool(obj, "fixed", style_ & Z_STYLE_FIXED_PITCH);
 }
 
+// The styles that show up in the output; conveniently, the Z-machine's own
+// bits are exactly the schema 2 bitmask.
+static const z_style OUTPUT_STYLES = Z_STYLE_REVERSE_VIDEO | Z_STYLE_BOLD | Z_STYLE_ITALIC | Z_STYLE_FIXED_PITCH;
+
+bool Format::IsPlain() const {
+    return (style_ & OUTPUT_STYLES) == 0;
+}
+
+void Format::WriteJsonProps(DocWriter &writer) const {
+    if (writer.Schema() >= 2) {
+        if (!IsPlain()) {
+            writer.Key("style");
+            writer.Integer(style_ & OUTPUT_STYLES);
+        }
+        return;
+    }
+
+    // The same (optional) properties, in the same order, as AddJsonProps().
+    const struct { z_style style; const char *name; } props[] = {
+        { Z_STYLE_REVERSE_VIDEO,    "reverse" },
+        { Z_STYLE_BOLD,             "bold" },
+        { Z_STYLE_ITALIC,           "italic" },
+        { Z_STYLE_FIXED_PITCH,      "fixed" },
+    };
+
+    for (const auto &prop : props) {
+        if (style_ & prop.style) {
+            writer.Key(prop.name);
+            writer.Bool(true);
+        }
+    }
+}
+
+void Format::Save(std::ostream &os) const {
+    SaveValue(os, font_);
+    SaveValue(os, style_);
+    SaveValue(os, foreground_colour_);
+    SaveValue(os, background_colour_);
+}
+
+bool Format::Load(std::istream &is) {
+    return LoadValue(is, font_) &&
+        LoadValue(is, style_) &&
+        LoadValue(is, foreground_colour_) &&
+        LoadValue(is, background_colour_);
+}
+
 std::ostream & operator<<(std::ostream &os, const Format& format) {
     return os << Format::FontName(format.font_, true) << "," << Format::StyleName(format.style_, true) << "," << Format::ColorName(format.foreground_colour_, true) << "," << Format::ColorName(format.background_colour_, true);
 }
@@ -8,6 +8,7 @@ extern "C" {
 }
 
 #include "blockbuf.h"
+#include "docwriter.h"
 
 
 class Format {
@@ -30,6 +31,14 @@ class Format {
     friend std::ostream & operator<<(std::ostream &os, const Format& format);
 
     void AddJsonProps(json_t *obj) const;
+    void WriteJsonProps(DocWriter &writer) const;
+
+    // True when none of the styles that show up in the output are set.
+    bool IsPlain() const;
+
+    // Snapshot support...
+    void Save(std::ostream &os) const;
+    bool Load(std::istream &is);
 
     // utility helpers...
     static const char * FontName(z_font font, bool brief = false);
@@ -0,0 +1,289 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "inputreader.h"
+
+#include "util.h"
+
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+InputReader::InputReader()
+: start_(0), scanned_(0), depth_(0), started_(false), inString_(false), escaped_(false) {
+}
+
+void InputReader::Append(const char *data, size_t len) {
+    trace(3, "[%p] %d bytes", this, len);
+
+    // Whatever has already been handed out can go.
+    if (start_ > 0) {
+        buffer_.erase(0, start_);
+        scanned_ -= start_;
+        start_ = 0;
+    }
+    buffer_.append(data, len);
+}
+
+bool InputReader::Next(std::string &message) {
+    while (scanned_ < buffer_.size()) {
+        const char c = buffer_[scanned_++];
+
+        if (inString_) {
+            if (escaped_) {
+                escaped_ = false;
+            } else if (c == '\\') {
+                escaped_ = true;
+            } else if (c == '"') {
+                inString_ = false;
+                if (depth_ == 0) {
+                    Complete(scanned_, message);
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        if (!started_) {
+            if (is_space(c)) {
+                start_ = scanned_;
+                continue;
+            }
+            started_ = true;
+        }
+
+        switch (c) {
+            case '"':
+                inString_ = true;
+                break;
+
+            case '{':
+            case '[':
+                ++depth_;
+                break;
+
+            case '}':
+            case ']':
+                if (--depth_ <= 0) {
+                    Complete(scanned_, message);
+                    return true;
+                }
+                break;
+
+            default:
+                // A bare scalar runs until whitespace; it isn't a valid
+                // message, but the parser gets to say so.
+                if (depth_ == 0 && is_space(c)) {
+                    Complete(scanned_ - 1, message);
+                    return true;
+                }
+                break;
+        }
+    }
+
+    return false;
+}
+
+bool InputReader::Partial() const {
+    return started_;
+}
+
+void InputReader::Complete(size_t end, std::string &message) {
+    message.assign(buffer_, start_, end - start_);
+    start_ = scanned_;
+    depth_ = 0;
+    started_ = false;
+}
+
+
+static const char *skip_space(const char *p, const char *end) {
+    while (p < end && is_space(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Reads the four hex digits of a \u escape.
+static bool read_hex4(const char *&p, const char *end, unsigned &value) {
+    if (end - p < 4) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+        int digit = hex_value(*p++);
+        if (digit < 0) {
+            return false;
+        }
+        value = (value << 4) | digit;
+    }
+    return true;
+}
+
+static void append_utf8(std::string &out, unsigned ch) {
+    if (ch < 0x80) {
+        out += (char)ch;
+    } else if (ch < 0x800) {
+        out += (char)(0xc0 | (ch >> 6));
+        out += (char)(0x80 | (ch & 0x3f));
+    } else if (ch < 0x10000) {
+        out += (char)(0xe0 | (ch >> 12));
+        out += (char)(0x80 | ((ch >> 6) & 0x3f));
+        out += (char)(0x80 | (ch & 0x3f));
+    } else {
+        out += (char)(0xf0 | (ch >> 18));
+        out += (char)(0x80 | ((ch >> 12) & 0x3f));
+        out += (char)(0x80 | ((ch >> 6) & 0x3f));
+        out += (char)(0x80 | (ch & 0x3f));
+    }
+}
+
+// The length of the well-formed UTF-8 sequence at `p`, or zero for one that
+// isn't (truncated, overlong, a surrogate, or past U+10FFFF); these are the
+// same sequences jansson rejects.
+static size_t utf8_sequence(const char *p, const char *end) {
+    const unsigned char *u = (const unsigned char *)p;
+    size_t len;
+    unsigned ch;
+    if (u[0] < 0x80) {
+        return 1;
+    } else if (u[0] >= 0xc2 && u[0] <= 0xdf) {
+        len = 2;
+        ch = u[0] & 0x1f;
+    } else if (u[0] >= 0xe0 && u[0] <= 0xef) {
+        len = 3;
+        ch = u[0] & 0x0f;
+    } else if (u[0] >= 0xf0 && u[0] <= 0xf4) {
+        len = 4;
+        ch = u[0] & 0x07;
+    } else {
+        return 0;
+    }
+
+    if ((size_t)(end - p) < len) {
+        return 0;
+    }
+    for (size_t i = 1; i < len; ++i) {
+        if ((u[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+        ch = (ch << 6) | (u[i] & 0x3f);
+    }
+
+    if ((len == 3 && ch < 0x800) || (len == 4 && ch < 0x10000) ||
+        (ch >= 0xd800 && ch <= 0xdfff) || ch > 0x10ffff) {
+        return 0;
+    }
+    return len;
+}
+
+bool input_parse_plain(const char *message, size_t len, std::string &input) {
+    static const char key[] = "\"input\"";
+
+    const char *p = message;
+    const char *end = message + len;
+
+    p = skip_space(p, end);
+    if (p == end || *p++ != '{') {
+        return false;
+    }
+
+    p = skip_space(p, end);
+    if ((size_t)(end - p) < sizeof(key) - 1 || std::char_traits<char>::compare(p, key, sizeof(key) - 1) != 0) {
+        return false;
+    }
+    p += sizeof(key) - 1;
+
+    p = skip_space(p, end);
+    if (p == end || *p++ != ':') {
+        return false;
+    }
+
+    p = skip_space(p, end);
+    if (p == end || *p++ != '"') {
+        return false;
+    }
+
+    input.clear();
+    for (;;) {
+        // Copy runs of ordinary characters at once, checking any UTF-8 on
+        // the way (as the full parser would).
+        const char *run = p;
+        while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) {
+            if ((unsigned char)*p < 0x80) {
+                ++p;
+                continue;
+            }
+            size_t n = utf8_sequence(p, end);
+            if (!n) {
+                return false;
+            }
+            p += n;
+        }
+        input.append(run, p - run);
+
+        if (p == end || (unsigned char)*p < 0x20) {
+            return false;
+        }
+        if (*p++ == '"') {
+            break;
+        }
+
+        // An escape.
+        if (p == end) {
+            return false;
+        }
+        switch (*p++) {
+            case '"':   input += '"';   break;
+            case '\\':  input += '\\';  break;
+            case '/':   input += '/';   break;
+            case 'b':   input += '\b';  break;
+            case 'f':   input += '\f';  break;
+            case 'n':   input += '\n';  break;
+            case 'r':   input += '\r';  break;
+            case 't':   input += '\t';  break;
+
+            case 'u': {
+                unsigned ch;
+                if (!read_hex4(p, end, ch) || ch == 0 || (ch >= 0xdc00 && ch <= 0xdfff)) {
+                    return false;
+                }
+                if (ch >= 0xd800 && ch <= 0xdbff) {
+                    unsigned low;
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u') {
+                        return false;
+                    }
+                    p += 2;
+                    if (!read_hex4(p, end, low) || low < 0xdc00 || low > 0xdfff) {
+                        return false;
+                    }
+                    ch = 0x10000 + ((ch - 0xd800) << 10) + (low - 0xdc00);
+                }
+                append_utf8(input, ch);
+                break;
+            }
+
+            default:
+                return false;
+        }
+    }
+
+    p = skip_space(p, end);
+    if (p == end || *p++ != '}') {
+        return false;
+    }
+
+    return skip_space(p, end) == end;
+}
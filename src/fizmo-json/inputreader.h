@@ -0,0 +1,46 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_INPUTREADER_H
+#define FIZMO_JSON_INPUTREADER_H
+
+#include <string>
+
+
+// Splits a stream of JSON texts (pretty-printed or not, separated by any
+// amount of whitespace, or none at all) into messages as the bytes arrive.
+// Scanning picks up where it left off, so however the input happens to be
+// chunked each byte is only looked at once, and any number of complete
+// messages can be waiting; a client is free to pipeline several commands.
+class InputReader {
+  public:
+    InputReader();
+
+    void Append(const char *data, size_t len);
+
+    // Extracts the next complete message, if there is one.
+    bool Next(std::string &message);
+
+    // Whether anything but whitespace is left over (which, at the end of the
+    // input, is an incomplete message).
+    bool Partial() const;
+
+  private:
+    void Complete(size_t end, std::string &message);
+
+    std::string buffer_;
+    size_t      start_;     // where the current message begins
+    size_t      scanned_;   // how much of it has been scanned
+    int         depth_;
+    bool        started_;
+    bool        inString_;
+    bool        escaped_;
+};
+
+// The fast path for the one message nearly every turn gets, `{"input":"..."}`
+// (with any whitespace): when `message` is exactly that, sets `input` to the
+// unescaped string without building a JSON document.  Returns false for
+// anything else (or anything unusual, like a NUL or invalid UTF-8), which
+// should go to the full parser instead.
+extern bool input_parse_plain(const char *message, size_t len, std::string &input);
+
+#endif // FIZMO_JSON_INPUTREADER_H
@@ -0,0 +1,158 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "iothread.h"
+
+extern "C" {
+    #include <errno.h>
+    #include <stdlib.h>
+    #include <string.h>
+    #include <unistd.h>
+}
+
+#include "util.h"
+
+
+ThreadedTransport::ThreadedTransport(Transport *inner, size_t maxFrames, size_t maxMessages)
+: inner_(inner), messages_(maxMessages), frames_(maxFrames), closed_(false), readerDone_(false), writeFailed_(false) {
+    trace(2, "[%p] %p, %d, %d", this, inner, maxFrames, maxMessages);
+    sem_init(&flushed_, 0, 0);
+    encoding_ = inner->GetEncoding();
+    reader_ = std::thread(&ThreadedTransport::ReadLoop, this);
+    writer_ = std::thread(&ThreadedTransport::WriteLoop, this);
+}
+
+ThreadedTransport::~ThreadedTransport() {
+    trace(2, "[%p]", this);
+
+    frames_.Push({ STOP, "" });
+    writer_.join();
+
+    // The reader is most likely blocked reading the next message, and there's
+    // no portable way to interrupt it; once it has finished it can be joined,
+    // otherwise it (and so the inner transport) has to be abandoned.
+    if (readerDone_) {
+        reader_.join();
+        delete inner_;
+    } else {
+        reader_.detach();
+    }
+
+    for (int fd : fds_) {
+        close(fd);
+    }
+    sem_destroy(&flushed_);
+}
+
+void ThreadedTransport::ReadLoop() {
+    for (;;) {
+        Message message;
+        message.closed = false;
+        if (!inner_->ReadInput(message.input)) {
+            message.closed = true;
+        }
+
+        int fd;
+        while ((fd = inner_->TakeFd()) >= 0) {
+            message.fds.push_back(fd);
+        }
+
+        const bool closed = message.closed;
+        messages_.Push(std::move(message));
+        if (closed) {
+            readerDone_ = true;
+            return;
+        }
+    }
+}
+
+void ThreadedTransport::WriteLoop() {
+    for (;;) {
+        Frame frame = frames_.Pop();
+        switch (frame.kind) {
+            case FRAME:
+                if (!writeFailed_ && !inner_->WriteFrame(frame.bytes)) {
+                    tracex(1, "unable to write frame: %s", strerror(errno));
+                    writeFailed_ = true;
+                }
+                break;
+
+            case FLUSH:
+                inner_->Flush();
+                sem_post(&flushed_);
+                break;
+
+            case STOP:
+                return;
+        }
+    }
+}
+
+bool ThreadedTransport::ReadInput(InputMessage &input) {
+    if (closed_) {
+        return false;
+    }
+
+    Message message = messages_.Pop();
+    fds_.insert(fds_.end(), message.fds.begin(), message.fds.end());
+
+    if (message.closed) {
+        closed_ = true;
+        return false;
+    }
+
+    input = std::move(message.input);
+    return true;
+}
+
+bool ThreadedTransport::ReadMessage(std::string &message) {
+    InputMessage input;
+    if (!ReadInput(input)) {
+        return false;
+    }
+
+    // Messages were parsed as they arrived; hand back a canonical (JSON)
+    // copy.
+    json_t *json = input.json;
+    if (input.plain) {
+        json = json_object();
+        json_object_set_new(json, "input", json_stringn(input.input.data(), input.input.size()));
+    }
+    char *str = json ? json_dumps(json, JSON_COMPACT) : NULL;
+    message = str ? str : "";
+    free(str);
+    json_decref(json);
+    return true;
+}
+
+bool ThreadedTransport::WriteFrame(const std::string &frame) {
+    trace(2, "[%p] %d bytes", this, frame.size());
+    frames_.Push({ FRAME, frame });
+    return !writeFailed_;
+}
+
+size_t ThreadedTransport::JsonFlags() const {
+    return inner_->JsonFlags();
+}
+
+void ThreadedTransport::Flush() {
+    trace(2, "[%p]", this);
+    frames_.Push({ FLUSH, "" });
+    while (sem_wait(&flushed_) < 0 && errno == EINTR) {
+    }
+}
+
+// Messages are decoded by the inner transport, on the reader thread.  (Set
+// the encoding before the first message arrives.)
+void ThreadedTransport::SetEncoding(Encoding encoding) {
+    Transport::SetEncoding(encoding);
+    inner_->SetEncoding(encoding);
+}
+
+int ThreadedTransport::TakeFd() {
+    if (fds_.empty()) {
+        return -1;
+    }
+    int fd = fds_.front();
+    fds_.erase(fds_.begin());
+    return fd;
+}
@@ -0,0 +1,73 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_IOTHREAD_H
+#define FIZMO_JSON_IOTHREAD_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <semaphore.h>
+}
+
+#include "spscqueue.h"
+#include "transport.h"
+
+
+// Wraps another transport so that all of its (blocking) I/O happens on
+// background threads.  A reader thread reads and parses the next messages
+// ahead of time, and a writer thread drains finished frames; both talk to the
+// interpreter through lock-free SPSC channels.  So the interpreter only ever
+// pops an already-parsed message, and only waits on output once `maxFrames`
+// frames are queued for a consumer that isn't keeping up.
+//
+// Threads don't survive fork(), so this is only for sessions that never fork
+// (or that replace the transport in the child without touching this one).
+class ThreadedTransport : public Transport {
+  public:
+    // Takes ownership of `inner`.
+    ThreadedTransport(Transport *inner, size_t maxFrames = 64, size_t maxMessages = 16);
+    ~ThreadedTransport();
+
+    bool ReadMessage(std::string &message) override;
+    bool ReadInput(InputMessage &message) override;
+    bool WriteFrame(const std::string &frame) override;
+    size_t JsonFlags() const override;
+    void Flush() override;
+    int TakeFd() override;
+    void SetEncoding(Encoding encoding) override;
+
+  private:
+    // A message as prefetched by the reader thread, along with any
+    // descriptors that arrived with it.
+    struct Message {
+        InputMessage        input;
+        bool                closed;
+        std::vector<int>    fds;
+    };
+
+    enum FrameKind { FRAME, FLUSH, STOP };
+
+    struct Frame {
+        FrameKind       kind;
+        std::string     bytes;
+    };
+
+    void ReadLoop();
+    void WriteLoop();
+
+    Transport               *inner_;
+    SpscChannel<Message>    messages_;
+    SpscChannel<Frame>      frames_;
+    sem_t                   flushed_;
+    bool                    closed_;            // interpreter side
+    std::atomic<bool>       readerDone_;
+    std::atomic<bool>       writeFailed_;
+    std::vector<int>        fds_;
+    std::thread             reader_;
+    std::thread             writer_;
+};
+
+#endif // FIZMO_JSON_IOTHREAD_H
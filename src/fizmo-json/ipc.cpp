@@ -0,0 +1,158 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "ipc.h"
+
+extern "C" {
+    #include <errno.h>
+    #include <stdio.h>
+    #include <string.h>
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+}
+
+#include "util.h"
+
+
+int ipc_listen(const char *path) {
+    trace(1, "%s", path);
+
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path too long: %s\n", path);
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        fprintf(stderr, "ERROR: unable to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    unlink(path);
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, SOMAXCONN) < 0) {
+        fprintf(stderr, "ERROR: unable to listen on %s: %s\n", path, strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+bool ipc_send(int sock, const void *data, size_t len, const int *fds, int nfds) {
+    trace(2, "%d, %p, %d, %p, %d", sock, data, len, fds, nfds);
+
+    ssize_t n = ipc_send_some(sock, data, len, fds, nfds);
+    if (n != (ssize_t)len) {
+        tracex(1, "sendmsg failed: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+ssize_t ipc_send_some(int sock, const void *data, size_t len, const int *fds, int nfds) {
+    trace(3, "%d, %p, %d, %p, %d", sock, data, len, fds, nfds);
+
+    struct iovec iov = { const_cast<void *>(data), len };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(sizeof(int) * IPC_MAX_FDS)];
+    if (fds && nfds > 0) {
+        if (nfds > IPC_MAX_FDS) {
+            tracex(1, "too many descriptors: %d", nfds);
+            errno = EINVAL;
+            return -1;
+        }
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    }
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+
+    return n;
+}
+
+ssize_t ipc_recv(int sock, void *data, size_t len, int *fds, int *nfds) {
+    trace(2, "%d, %p, %d", sock, data, len);
+
+    struct iovec iov = { data, len };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(sizeof(int) * IPC_MAX_FDS)];
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    int received = 0;
+    if (n >= 0) {
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int *incoming = (const int *)CMSG_DATA(cmsg);
+            for (int i = 0; i < count; i++) {
+                // Never leak descriptors we have no room for.
+                if (fds && nfds && received < *nfds) {
+                    fds[received++] = incoming[i];
+                } else {
+                    close(incoming[i]);
+                }
+            }
+        }
+    }
+
+    if (nfds) {
+        *nfds = received;
+    }
+
+    return n;
+}
+
+bool ipc_write_all(int fd, const void *data, size_t len) {
+    const char *p = (const char *)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            tracex(1, "write failed: %s", strerror(errno));
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+std::string ipc_basename(const std::string &path) {
+    auto slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
@@ -0,0 +1,40 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_IPC_H
+#define FIZMO_JSON_IPC_H
+
+#include <string>
+
+extern "C" {
+    #include <sys/types.h>
+}
+
+// The maximum number of file descriptors that can accompany a single
+// message; this is plenty for handing a session its input and output.
+const int IPC_MAX_FDS = 4;
+
+// Creates a listening unix-domain socket at `path` (replacing any stale
+// socket file), returning the descriptor or -1 on failure.
+extern int ipc_listen(const char *path);
+
+// Sends one datagram-like message over a unix-domain socket, along with
+// `nfds` file descriptors (via SCM_RIGHTS).  Returns false on failure.
+extern bool ipc_send(int sock, const void *data, size_t len, const int *fds = NULL, int nfds = 0);
+
+// Like ipc_send(), but for stream sockets where a partial write is fine; the
+// descriptors go along with the first byte.  Returns the number of bytes
+// sent, or -1 on error.
+extern ssize_t ipc_send_some(int sock, const void *data, size_t len, const int *fds = NULL, int nfds = 0);
+
+// Receives a message sent by ipc_send().  On entry `*nfds` is the capacity of
+// `fds`, on exit it is the number of descriptors received.  Returns the number
+// of bytes received, 0 on EOF, or -1 on error.
+extern ssize_t ipc_recv(int sock, void *data, size_t len, int *fds = NULL, int *nfds = NULL);
+
+// Writes the entire buffer, retrying on short writes and EINTR.
+extern bool ipc_write_all(int fd, const void *data, size_t len);
+
+// Returns the final path component of `path`.
+extern std::string ipc_basename(const std::string &path);
+
+#endif // FIZMO_JSON_IPC_H
@@ -0,0 +1,194 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "jsonwriter.h"
+
+extern "C" {
+    #include <stdio.h>
+    #include <string.h>
+    #include <jansson.h>
+}
+
+#include "util.h"
+
+
+// The bits of the jansson flags that hold the indent (JSON_INDENT(n)).
+static const size_t INDENT_MASK = 0x1F;
+
+
+JsonWriter::JsonWriter()
+: indent_(0), compact_(true), afterKey_(false) {
+    trace(2, "[%p]", this);
+}
+
+void JsonWriter::Reset(size_t flags) {
+    out_.clear();
+    stack_.clear();
+    indent_ = flags & INDENT_MASK;
+    compact_ = (flags & JSON_COMPACT) != 0;
+    afterKey_ = false;
+}
+
+const std::string &JsonWriter::Str() const {
+    return out_;
+}
+
+// This mirrors jansson's dump_indent(): with an indent, a newline and
+// `depth` levels of it; otherwise, maybe a single space.
+void JsonWriter::Indent(size_t depth, bool space) {
+    if (indent_ > 0) {
+        out_ += '\n';
+        out_.append(depth * indent_, ' ');
+    } else if (space && !compact_) {
+        out_ += ' ';
+    }
+}
+
+// Emits whatever belongs between the previous value (or the opening bracket)
+// and the next one.
+void JsonWriter::Separate() {
+    if (afterKey_) {
+        afterKey_ = false;
+        return;
+    }
+
+    if (stack_.empty()) {
+        return;
+    }
+
+    if (stack_.back().count++ > 0) {
+        out_ += ',';
+        Indent(stack_.size(), true);
+    } else {
+        Indent(stack_.size(), false);
+    }
+}
+
+void JsonWriter::Begin(char open, char close) {
+    Separate();
+    out_ += open;
+    stack_.push_back({ close, 0 });
+}
+
+void JsonWriter::End() {
+    Level level = stack_.back();
+    stack_.pop_back();
+
+    // Empty containers stay on one line: "[]" and "{}".
+    if (level.count > 0) {
+        Indent(stack_.size(), false);
+    }
+    out_ += level.close;
+}
+
+void JsonWriter::BeginObject() {
+    Begin('{', '}');
+}
+
+void JsonWriter::EndObject() {
+    End();
+}
+
+void JsonWriter::BeginArray() {
+    Begin('[', ']');
+}
+
+void JsonWriter::EndArray() {
+    End();
+}
+
+void JsonWriter::Key(const char *key) {
+    Separate();
+    Escape(key, strlen(key));
+    out_ += compact_ ? ":" : ": ";
+    afterKey_ = true;
+}
+
+void JsonWriter::String(const char *str, size_t len) {
+    Separate();
+    Escape(str, len);
+}
+
+
+void JsonWriter::Integer(long long value) {
+    Separate();
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%lld", value);
+    out_.append(buf, n);
+}
+
+// Like jansson's default: 17 significant digits, always with a decimal point
+// or exponent (and without an exponent's '+' or leading zeros).
+void JsonWriter::Real(double value) {
+    Separate();
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.17g", value);
+    std::string str = buf;
+
+    if (str.find_first_of(".eEin") == std::string::npos) {
+        str += ".0";
+    }
+
+    auto e = str.find('e');
+    if (e != std::string::npos) {
+        size_t digits = e + 1;
+        if (str[digits] == '+') {
+            str.erase(digits, 1);
+        } else if (str[digits] == '-') {
+            ++digits;
+        }
+        while (str.size() > digits + 1 && str[digits] == '0') {
+            str.erase(digits, 1);
+        }
+    }
+
+    out_ += str;
+}
+
+void JsonWriter::Bool(bool value) {
+    Separate();
+    out_ += value ? "true" : "false";
+}
+
+void JsonWriter::Null() {
+    Separate();
+    out_ += "null";
+}
+
+// jansson's escaping: quotes, backslashes and control characters only (the
+// text is already UTF-8, and '/' isn't escaped without JSON_ESCAPE_SLASH).
+// Runs of ordinary characters are copied in one go.
+void JsonWriter::Escape(const char *str, size_t len) {
+    out_ += '"';
+
+    const char *run = str;
+    const char *end = str + len;
+    for (const char *p = str; p < end; ++p) {
+        const unsigned char ch = *p;
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+
+        out_.append(run, p - run);
+        run = p + 1;
+
+        switch (ch) {
+            case '\\':  out_ += "\\\\"; break;
+            case '"':   out_ += "\\\""; break;
+            case '\b':  out_ += "\\b";  break;
+            case '\f':  out_ += "\\f";  break;
+            case '\n':  out_ += "\\n";  break;
+            case '\r':  out_ += "\\r";  break;
+            case '\t':  out_ += "\\t";  break;
+            default: {
+                char seq[8];
+                snprintf(seq, sizeof(seq), "\\u%04X", ch);
+                out_ += seq;
+                break;
+            }
+        }
+    }
+    out_.append(run, end - run);
+
+    out_ += '"';
+}
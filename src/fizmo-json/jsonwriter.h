@@ -0,0 +1,59 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_JSONWRITER_H
+#define FIZMO_JSON_JSONWRITER_H
+
+#include <string>
+#include <vector>
+
+#include "docwriter.h"
+
+
+// Streams JSON text straight into a single, reusable buffer, rather than
+// building a jansson tree and then dumping it.  The output is byte-for-byte
+// what json_dumps() produces for the same jansson flags (JSON_COMPACT and
+// JSON_INDENT(n) are the ones that matter), including jansson's escaping
+// and its rules for where newlines and indentation go.
+//
+class JsonWriter : public DocWriter {
+  public:
+    JsonWriter();
+
+    // Starts a new document, keeping the buffer's capacity.
+    void Reset(size_t flags);
+
+    void BeginObject() override;
+    void EndObject() override;
+    void BeginArray() override;
+    void EndArray() override;
+
+    using DocWriter::String;
+    void Key(const char *key) override;
+    void String(const char *str, size_t len) override;
+    void Integer(long long value) override;
+    void Real(double value) override;
+    void Bool(bool value) override;
+    void Null() override;
+
+    const std::string &Str() const override;
+
+  private:
+    struct Level {
+        char    close;
+        size_t  count;
+    };
+
+    void Begin(char open, char close);
+    void End();
+    void Separate();
+    void Indent(size_t depth, bool space);
+    void Escape(const char *str, size_t len);
+
+    std::string         out_;
+    std::vector<Level>  stack_;
+    size_t              indent_;
+    bool                compact_;
+    bool                afterKey_;
+};
+
+#endif // FIZMO_JSON_JSONWRITER_H
@@ -1,18 +1,21 @@
 // This file is part of fizmo-json.  Please see LICENSE.md for the license.
 
 #include "paragraph.h"
+#include "serialize.h"
 #include "util.h"
 
-Paragraph::Paragraph() {
+Paragraph::Paragraph()
+: bytes_(0) {
     trace(2, "[%p]", this);
 }
 
 Paragraph::Paragraph(const Paragraph &paragraph)
-: spans_(paragraph.spans_) {
+: spans_(paragraph.spans_), bytes_(paragraph.bytes_) {
     trace(2, "[%p] copy from %p", this, &paragraph);
 }
 
-Paragraph::Paragraph(const BlockBuf &buf, int line, int start, int end) {
+Paragraph::Paragraph(const BlockBuf &buf, int line, int start, int end)
+: bytes_(0) {
     trace(2, "[%p] %p, %d, %d, %d", this, &buf, line, start, end);
 
     z_style style = buf.At(line, start).style;
@@ -23,6 +26,7 @@ Paragraph::Paragraph(const BlockBuf &buf, int line, int start, int end) {
         if (buf.At(line, i).style != style) {
             // Span span(buf, line, spanStart, i);
             spans_.emplace_back(buf, line, spanStart, i);
+            bytes_ += spans_.back().Bytes();
             spanStart = i;
             style = buf.At(line, spanStart).style;
             tracex(3, "new style: %d", style);
@@ -31,14 +35,17 @@ Paragraph::Paragraph(const BlockBuf &buf, int line, int start, int end) {
     }
 
     spans_.emplace_back(buf, line, spanStart, end);
+    bytes_ += spans_.back().Bytes();
 }
 
-Paragraph::Paragraph(const struct blockbuf_char& bbch) {
+Paragraph::Paragraph(const struct blockbuf_char& bbch)
+: bytes_(0) {
     trace(2, "[%p] %c", this, bbch.character);
     Append(bbch);
 }
 
-Paragraph::Paragraph(const std::string &str, const Format &format) {
+Paragraph::Paragraph(const std::string &str, const Format &format)
+: bytes_(str.size()) {
     trace(2, "[%p] \"%s\"", this, str.c_str());
     if (!str.empty()) {
         spans_.emplace_back(str, format);
@@ -59,9 +66,13 @@ bool Paragraph::Append(const struct blockbuf_char& bbch) {
     }
 
     Span *last = spans_.empty() ? NULL : &spans_.back();
+    const size_t before = last ? last->Bytes() : 0;
 
     if (last == NULL || !last->Append(bbch)) {
         spans_.emplace_back(bbch);
+        bytes_ += spans_.back().Bytes();
+    } else {
+        bytes_ += last->Bytes() - before;
     }
 
     return true;
@@ -77,6 +88,16 @@ void Paragraph::Append(const std::string &str, const Format &format) {
     if (spans_.empty() || !spans_.back().Append(str, format)) {
         spans_.emplace_back(str, format);
     }
+    bytes_ += str.size();
+}
+
+bool Paragraph::IsPlain() const {
+    for (const auto &s : spans_) {
+        if (!s.GetFormat().IsPlain()) {
+            return false;
+        }
+    }
+    return true;
 }
 
 bool Paragraph::IsEmpty() const {
@@ -96,7 +117,60 @@ json_t* Paragraph::ToJson() const {
 
     return obj;
 }
+void Paragraph::WriteJson(DocWriter &writer) const {
+    if (writer.Schema() >= 2 && IsPlain()) {
+        // Spans only split on formatting, so a plain paragraph is nearly
+        // always a single span (or none at all).
+        if (spans_.empty()) {
+            writer.String("", 0);
+        } else if (spans_.size() == 1) {
+            writer.String(spans_.front().Text());
+        } else {
+            std::string text;
+            for (const auto &s : spans_) {
+                text += s.Text();
+            }
+            writer.String(text);
+        }
+        return;
+    }
+
+    writer.BeginArray();
+    for (const auto &s : spans_) {
+        s.WriteJson(writer);
+    }
+    writer.EndArray();
+}
 
+size_t Paragraph::Bytes() const {
+    return bytes_;
+}
+
+
+void Paragraph::Save(std::ostream &os) const {
+    SaveValue(os, (uint32_t)spans_.size());
+    for (const auto &s : spans_) {
+        s.Save(os);
+    }
+}
+
+bool Paragraph::Load(std::istream &is) {
+    uint32_t count;
+    if (!LoadValue(is, count)) {
+        return false;
+    }
+
+    spans_.clear();
+    bytes_ = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        spans_.emplace_back();
+        if (!spans_.back().Load(is)) {
+            return false;
+        }
+        bytes_ += spans_.back().Bytes();
+    }
+    return true;
+}
 
 
 std::ostream & operator<<(std::ostream &os, const Paragraph& run) {
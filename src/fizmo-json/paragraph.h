@@ -31,7 +31,19 @@ class Paragraph {
 
     bool IsEmpty() const;
 
+    // True when none of the spans have any (output) styling.
+    bool IsPlain() const;
+
     json_t* ToJson() const;
+    void WriteJson(DocWriter &writer) const;
+
+    // The size of the paragraph's (UTF-8) text, kept up to date as spans are
+    // added, so that it's cheap to ask after every append.
+    size_t Bytes() const;
+
+    // Snapshot support...
+    void Save(std::ostream &os) const;
+    bool Load(std::istream &is);
 
     // Debugging helper?  Do we like this, or is the operator overload
     // obnoxious?
@@ -39,6 +51,7 @@ class Paragraph {
 
   private:
     std::list<Span> spans_;
+    size_t          bytes_;
 };
 
 #endif // FIZMO_JSON_LINE_H
@@ -0,0 +1,122 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "paragraphrefs.h"
+
+#include <iterator>
+
+#include "serialize.h"
+#include "util.h"
+
+
+ParagraphRefs::ParagraphRefs()
+: capacity_(0), nextId_(1) {
+    trace(2, "[%p]", this);
+}
+
+void ParagraphRefs::SetCapacity(size_t capacity) {
+    trace(1, "[%p] %d", this, capacity);
+    capacity_ = capacity;
+    Reset();
+}
+
+size_t ParagraphRefs::Capacity() const {
+    return capacity_;
+}
+
+void ParagraphRefs::Reset() {
+    trace(2, "[%p]", this);
+    lru_.clear();
+    index_.clear();
+    nextId_ = 1;
+}
+
+void ParagraphRefs::WriteJson(DocWriter &writer, const Paragraph &paragraph) {
+    if (!capacity_ || paragraph.IsEmpty()) {
+        paragraph.WriteJson(writer);
+        return;
+    }
+
+    scratch_.Reset(JSON_COMPACT);
+    scratch_.SetSchema(writer.Schema());
+    paragraph.WriteJson(scratch_);
+    const std::string &json = scratch_.Str();
+    const uint64_t hash = fnv1a_hash(json.data(), json.size());
+
+    auto range = index_.equal_range(hash);
+    for (auto found = range.first; found != range.second; ++found) {
+        if (found->second->json != json) {
+            continue;
+        }
+        lru_.splice(lru_.begin(), lru_, found->second);
+        writer.BeginObject();
+        writer.Key("ref");
+        writer.Integer(found->second->id);
+        writer.EndObject();
+        return;
+    }
+
+    paragraph.WriteJson(writer);
+    Insert(hash, nextId_++, json);
+}
+
+void ParagraphRefs::Insert(uint64_t hash, uint64_t id, const std::string &json) {
+    lru_.push_front({ hash, id, json });
+    index_.emplace(hash, lru_.begin());
+
+    if (lru_.size() > capacity_) {
+        auto oldest = std::prev(lru_.end());
+        auto range = index_.equal_range(oldest->hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == oldest) {
+                index_.erase(it);
+                break;
+            }
+        }
+        lru_.pop_back();
+    }
+}
+
+void ParagraphRefs::Save(std::ostream &os) const {
+    SaveValue(os, (uint64_t)capacity_);
+    SaveValue(os, nextId_);
+    SaveValue(os, (uint32_t)lru_.size());
+
+    // Least-recently-used first, so that loading can simply insert them in
+    // order.
+    for (auto it = lru_.crbegin(); it != lru_.crend(); ++it) {
+        SaveValue(os, it->id);
+        SaveString(os, it->json);
+    }
+}
+
+bool ParagraphRefs::Load(std::istream &is) {
+    uint64_t capacity;
+    uint32_t count;
+    if (!LoadValue(is, capacity) || !LoadValue(is, nextId_) || !LoadValue(is, count)) {
+        return false;
+    }
+
+    lru_.clear();
+    index_.clear();
+    capacity_ = capacity;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t id;
+        std::string json;
+        if (!LoadValue(is, id) || !LoadString(is, json)) {
+            return false;
+        }
+        Insert(fnv1a_hash(json.data(), json.size()), id, json);
+    }
+    return true;
+}
+
+
+uint64_t fnv1a_hash(const char *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,71 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_PARAGRAPHREFS_H
+#define FIZMO_JSON_PARAGRAPHREFS_H
+
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "docwriter.h"
+#include "jsonwriter.h"
+#include "paragraph.h"
+
+
+// Room descriptions (and the like) come back again and again, so a client
+// can ask for paragraphs it has already been sent to be referred to by id,
+// as `{ "ref": 17 }`, instead.  Both ends keep the same bounded LRU of
+// paragraphs, by following the same rules for every "story" paragraph:
+//
+//  - empty paragraphs are always sent as they are, and never remembered;
+//  - any other paragraph sent in full is remembered under the next id (the
+//    first is 1), evicting the least-recently-used one if the LRU is full;
+//  - a reference makes its paragraph the most-recently-used one.
+//
+// Paragraphs are looked up by a hash (FNV-1a) of their compact JSON, but
+// only a paragraph whose JSON matches exactly is ever sent as a reference.
+// (A colliding paragraph is simply sent, and remembered, in full.)
+class ParagraphRefs {
+  public:
+    ParagraphRefs();
+
+    // Sets how many paragraphs are remembered; zero turns references off.
+    // Either way, everything remembered so far is forgotten.
+    void SetCapacity(size_t capacity);
+    size_t Capacity() const;
+
+    // Forgets everything (for a client that's starting over).
+    void Reset();
+
+    // Writes the paragraph, or a reference to it.
+    void WriteJson(DocWriter &writer, const Paragraph &paragraph);
+
+    // Snapshot support...
+    void Save(std::ostream &os) const;
+    bool Load(std::istream &is);
+
+  private:
+    struct Entry {
+        uint64_t    hash;
+        uint64_t    id;
+        std::string json;
+    };
+
+    typedef std::list<Entry> Lru;
+    typedef std::unordered_multimap<uint64_t, Lru::iterator> Index;
+
+    void Insert(uint64_t hash, uint64_t id, const std::string &json);
+
+    size_t      capacity_;
+    uint64_t    nextId_;
+    Lru         lru_;   // most-recently-used first
+    Index       index_;
+    JsonWriter  scratch_;
+};
+
+// 64-bit FNV-1a.
+extern uint64_t fnv1a_hash(const char *data, size_t len);
+
+#endif // FIZMO_JSON_PARAGRAPHREFS_H
@@ -2,13 +2,21 @@
 
 #include "screen.h"
 
+#include <algorithm>
+#include <deque>
 #include <map>
+#include <regex>
 #include <string>
 
 extern "C" {
     #include <stdio.h>
+    #include <stdlib.h>
     #include <ctype.h>
+    #include <errno.h>
     #include <string.h>
+    #include <pthread.h>
+    #include <time.h>
+    #include <unistd.h>
     #include <sys/time.h>
 
     // fizmo includes...
@@ -25,8 +33,16 @@ extern "C" {
 #include "config.h"
 #include "util.h"
 #include "buffer.h"
+#include "cbor.h"
 #include "columns.h"
 #include "format.h"
+#include "jsonwriter.h"
+#include "paragraphrefs.h"
+#include "scrollback.h"
+#include "serialize.h"
+#include "snapshot.h"
+#include "statusdelta.h"
+#include "watchdog.h"
 
 Format currentFormat;
 Buffer screenBuffer;
@@ -66,36 +82,644 @@ void screen_use_simple_console_input() {
     use_simple_console_input = true;
 }
 
-// Generate a JSON object for the output...
-void generate_output() {
+static void (*first_input_hook)() = NULL;
+
+static Transport *transport = NULL;
+static std::string sessionId;
+static bool suppress_next_output = false;
+
+static ScreenOutputHandler output_handler;
+static ScreenInputHandler input_handler;
+
+void screen_set_first_input_hook(void (*hook)()) {
+    trace(1, "%p", hook);
+    first_input_hook = hook;
+}
+
+// The per-turn budget; see screen_set_turn_budget().
+static int turn_wall_ms = 0;
+static int turn_cpu_ms = 0;
+static Watchdog *watchdog = NULL;
+static pid_t watchdog_pid = 0;
+
+void screen_set_turn_budget(int wallMs, int cpuMs) {
+    trace(1, "%d, %d", wallMs, cpuMs);
+    turn_wall_ms = wallMs;
+    turn_cpu_ms = cpuMs;
+}
+
+// Single-key reads to answer without asking; see screen_set_auto_continue().
+static std::regex *auto_continue = NULL;
+static int auto_continued = 0;
+
+// The story text since the last read, which is all the pattern is matched
+// against, so that a prompt is never answered twice.  (Only the end of it can
+// matter, so only that much is kept.)
+static std::string auto_continue_text;
+const size_t AUTO_CONTINUE_TEXT_MAX = 1024;
+
+// A story that keeps asking for keys (a real-time game, say) eventually gets
+// to hear from the client after all.
+const int MAX_AUTO_CONTINUES = 100;
+
+bool screen_set_auto_continue(const char *pattern) {
+    if (!pattern) {
+        pattern = R"((press|hit|strike) (any|a) key|\[ *more *\]|<more>|-- *more *--)";
+    }
+    trace(1, "\"%s\"", pattern);
+
+    try {
+        delete auto_continue;
+        auto_continue = new std::regex(pattern, std::regex::ECMAScript | std::regex::icase | std::regex::optimize);
+    } catch (const std::regex_error &e) {
+        fprintf(stderr, "ERROR: bad auto-continue pattern \"%s\": %s\n", pattern, e.what());
+        auto_continue = NULL;
+        return false;
+    }
+    return true;
+}
+
+// Frames still queued on their way out are written before the process exits.
+static void flush_transport() {
+    if (transport) {
+        transport->Flush();
+    }
+}
+
+void screen_set_transport(Transport *newTransport) {
+    trace(1, "%p", newTransport);
+
+    static bool registered = false;
+    if (!registered) {
+        atexit(&flush_transport);
+        registered = true;
+    }
+
+    delete transport;
+    transport = newTransport;
+}
+
+void screen_set_handlers(ScreenOutputHandler output, ScreenInputHandler input) {
+    trace(1, "");
+    output_handler = output;
+    input_handler = input;
+}
+
+void screen_set_session(const std::string &session) {
+    trace(1, "\"%s\"", session.c_str());
+    sessionId = session;
+}
+
+// The output schema the client negotiated (see docwriter.h), and whether the
+// next frame should confirm it.
+static int output_schema = 1;
+static bool announce_schema = false;
+
+// Which parts of each frame the client wants (see "want" in handle_control());
+// the parts nobody wants aren't even computed.
+enum {
+    WANT_STORY          = 1 << 0,
+    WANT_STATUS_COLUMNS = 1 << 1,
+    WANT_STATUS_LINES   = 1 << 2,
+    WANT_ALL            = WANT_STORY | WANT_STATUS_COLUMNS | WANT_STATUS_LINES,
+};
+static int output_want = WANT_ALL;
+
+// Whether the client gets the status as changes (see statusdelta.h).
+static bool status_delta = false;
+static StatusDelta status_versions;
+
+// Story paragraphs the client already has (see paragraphrefs.h).
+static ParagraphRefs paragraph_refs;
+
+// How many paragraphs are remembered for `"refs": true`, and at most.
+const size_t DEFAULT_PARAGRAPH_REFS = 1024;
+const size_t MAX_PARAGRAPH_REFS = 65536;
+
+void screen_save_state(std::ostream &os) {
     trace(1, "");
+    currentFormat.Save(os);
+    SaveValue(os, upperWindowHeight);
+    SaveValue(os, currentWindow);
+    SaveValue(os, output_schema);
+    SaveValue(os, output_want);
+    SaveValue(os, status_delta);
+    status_versions.Save(os);
+    paragraph_refs.Save(os);
+    screenBuffer.Save(os);
+}
+
+bool screen_load_state(std::istream &is) {
+    trace(1, "");
+    suppress_next_output = true;
+    return currentFormat.Load(is) &&
+        LoadValue(is, upperWindowHeight) &&
+        LoadValue(is, currentWindow) &&
+        LoadValue(is, output_schema) &&
+        LoadValue(is, output_want) &&
+        LoadValue(is, status_delta) &&
+        status_versions.Load(is) &&
+        paragraph_refs.Load(is) &&
+        screenBuffer.Load(is);
+}
+
+// Partial output; see screen_set_partial_output().
+static int partial_paragraphs = 0;
+static int partial_ms = 0;
+static struct timespec partial_since;
+static size_t buffer_limit = 0;
+
+// Whether any of this turn's story output has already gone out (so that the
+// frames after the first are written as the rest of the turn; see the
+// `continued` flag of Buffer::WriteJson()).
+static bool turn_output_sent = false;
+
+// The scrollback log (see scrollback.h), when there's a directory for it.
+static std::string scrollback_dir;
+static ScrollbackLog *scrollback = NULL;
+static std::string scrollback_session;  // whose log it is...
+static pid_t scrollback_pid = 0;        // ...and in which process
+
+void screen_set_scrollback(const std::string &dir) {
+    trace(1, "%s", dir.c_str());
+    scrollback_dir = dir;
+}
+
+// The log's file name, from the session id (as long as that's a safe one).
+static std::string scrollback_path() {
+    std::string name = sessionId.empty() ? "pid-" + std::to_string(getpid()) : sessionId;
+    bool safe = true;
+    for (char &c : name) {
+        if (!isalnum((unsigned char)c) && c != '-' && c != '_') {
+            c = '_';
+            safe = false;
+        }
+    }
+
+    // Distinct ids mustn't end up sharing a file.
+    if (!safe) {
+        char hash[20];
+        snprintf(hash, sizeof(hash), "-%016llx", (unsigned long long)fnv1a_hash(sessionId.data(), sessionId.size()));
+        name += hash;
+    }
+    return scrollback_dir + "/" + name + ".scrollback";
+}
+
+// The current session's log, opened the first time it's needed.  A forked
+// process (including a clone, under its new id) opens a log of its own, and
+// lets go of the one it inherited.
+static ScrollbackLog *scrollback_log() {
+    if (scrollback_dir.empty()) {
+        return NULL;
+    }
+
+    if (scrollback && scrollback_pid == getpid() && scrollback_session == sessionId) {
+        return scrollback;
+    }
+
+    delete scrollback;
+    scrollback = ScrollbackLog::Open(scrollback_path());
+    scrollback_pid = getpid();
+    scrollback_session = sessionId;
+    return scrollback;
+}
+
+// The json_dumps() flags for output frames.
+static size_t output_flags() {
+    return transport ? transport->JsonFlags() : JSON_INDENT(2);
+}
+
+// Writes a complete, serialized output frame; a numbered one (`seq`) is
+// added to the scrollback log as well.
+static void write_frame(const std::string &frame, uint64_t seq = 0) {
+    if (seq && scrollback && !scrollback->Append(seq, frame)) {
+        fprintf(stderr, "ERROR: unable to add frame %llu to the scrollback log\n", (unsigned long long)seq);
+    }
+
+    if (transport) {
+        transport->WriteFrame(frame);
+        return;
+    }
+
+    fwrite(frame.data(), 1, frame.size(), stdout);
+    fputc('\n', stdout);
+    fflush(stdout);
+}
+
+static bool cbor_output() {
+    return transport && transport->GetEncoding() == ENCODING_CBOR;
+}
+
+// Writes a complete output object (and releases it).
+static void write_output(json_t *output) {
+    if (cbor_output()) {
+        CborWriter writer;
+        writer.Value(output);
+        json_decref(output);
+        write_frame(writer.Str());
+        return;
+    }
+
+    char *str = json_dumps(output, output_flags());
+    json_decref(output);
+    write_frame(str);
+    free(str);
+}
+
+// Starts an output object, tagged with the session (if any).
+static json_t *begin_output() {
+    json_t* output = json_object();
+    if (!sessionId.empty()) {
+        json_object_set_new(output, "session", json_string(sessionId.c_str()));
+    }
+    return output;
+}
+
+// Frames are streamed straight into a buffer (which only ever grows) by
+// whichever writer matches the output encoding, with no intermediate jansson
+// tree.  For JSON, the result is identical to what begin_output() and
+// write_output() would produce (except that those frames are never numbered).
+class FrameWriter {
+  public:
+    FrameWriter() : seq_(0) {}
+
+    // Starts a frame: opens the output object, and tags it with the session
+    // (if any) and newly-negotiated schema.
+    DocWriter &Begin() {
+        DocWriter *writer;
+        if (cbor_output()) {
+            cbor_.Reset();
+            writer = &cbor_;
+        } else {
+            json_.Reset(output_flags());
+            writer = &json_;
+        }
+
+        writer->SetSchema(output_schema);
+        writer->BeginObject();
+        if (!sessionId.empty()) {
+            writer->Key("session");
+            writer->String(sessionId);
+        }
+
+        ScrollbackLog *log = scrollback_log();
+        seq_ = log ? log->NextSeq() : 0;
+        if (seq_) {
+            writer->Key("seq");
+            writer->Integer(seq_);
+        }
+
+        if (announce_schema) {
+            writer->Key("schema");
+            writer->Integer(output_schema);
+        }
+        return *writer;
+    }
+
+    // Writes the (ended) frame that `writer` built.
+    void Write(DocWriter &writer) {
+        write_frame(writer.Str(), seq_);
+        seq_ = 0;
+    }
+
+  private:
+    JsonWriter  json_;
+    CborWriter  cbor_;
+    uint64_t    seq_;
+};
+
+// A final frame for a turn that had to be abandoned: the error, and what the
+// story had output so far.  The caller writes any other error details, and
+// then ends the frame.
+static DocWriter &begin_error_frame(FrameWriter &frames, const char *type) {
+    DocWriter &writer = frames.Begin();
+    writer.Key("error");
+    writer.BeginObject();
+    writer.Key("type");
+    writer.String(type, strlen(type));
+    return writer;
+}
+
+static void end_error_frame(FrameWriter &frames, DocWriter &writer) {
+    writer.EndObject();
+    writer.Key("story");
+    screenBuffer.WriteJson(writer, !turn_output_sent, true, NULL, turn_output_sent);
+    writer.EndObject();
+    frames.Write(writer);
+}
+
+// Called on the watchdog thread (with the screen locked) when a turn has run
+// out of time: reports what the story has said so far, and gives up.
+static void turn_expired(const char *budget, int limitMs) {
+    tracex(1, "turn exceeded its %s budget of %d ms", budget, limitMs);
+
+    FrameWriter frames;
+    DocWriter &writer = begin_error_frame(frames, "timeout");
+    writer.Key("budget");
+    writer.String(budget, strlen(budget));
+    writer.Key("limit");
+    writer.Integer(limitMs);
+    end_error_frame(frames, writer);
+
+    if (transport) {
+        transport->Flush();
+    }
+
+    // The interpreter is still running on its own thread, so none of the
+    // usual exit handling is safe.
+    _exit(2);
+}
+
+// The watchdog runs between one request for input and the next.  Threads
+// don't survive fork(), so a forked session starts a watchdog of its own.
+static void start_turn() {
+    if (!turn_wall_ms && !turn_cpu_ms) {
+        return;
+    }
+
+    if (watchdog_pid != getpid()) {
+        // Any watchdog we have belongs to the parent; its thread is gone.
+        watchdog = new Watchdog(turn_wall_ms, turn_cpu_ms, &turn_expired);
+        watchdog_pid = getpid();
+    }
+    watchdog->Arm();
+}
+
+static void end_turn() {
+    if (watchdog && watchdog_pid == getpid()) {
+        watchdog->Disarm();
+    }
+}
+
+// Guards screen buffer changes that a turn makes against the watchdog
+// reading the buffer at the same time.
+class TurnLock {
+  public:
+    TurnLock() : mutex_(watchdog && watchdog_pid == getpid() ? &watchdog->Mutex() : NULL) {
+        if (mutex_) {
+            mutex_->lock();
+        }
+    }
+    ~TurnLock() {
+        if (mutex_) {
+            mutex_->unlock();
+        }
+    }
+
+  private:
+    std::mutex *mutex_;
+};
+
+// Memory limits; see screen_set_memory_limits().
+static long max_rss_kb = 0;
+
+// Mid-turn, the RSS is checked again each time the buffer grows by this much.
+static const size_t RSS_CHECK_INTERVAL = 1024 * 1024;
+static size_t next_rss_check = 0;
+
+void screen_set_memory_limits(size_t maxOutputBytes, long maxRssMb) {
+    trace(1, "%d, %ld", maxOutputBytes, maxRssMb);
+    screenBuffer.SetLimit(maxOutputBytes);
+    max_rss_kb = maxRssMb * 1024;
+}
+
+// The process's resident set size, or -1 if it can't be determined.
+static long process_rss_kb() {
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm) {
+        return -1;
+    }
+
+    long size;
+    long resident;
+    int n = fscanf(statm, "%ld %ld", &size, &resident);
+    fclose(statm);
+
+    return n == 2 ? resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+}
+
+// Gives up, with an error frame carrying what the turn has output so far,
+// once the process is using more memory than it's allowed.
+static void check_memory() {
+    if (!max_rss_kb) {
+        return;
+    }
+
+    next_rss_check = screenBuffer.Bytes() + RSS_CHECK_INTERVAL;
+
+    long rss = process_rss_kb();
+    if (rss < 0 || rss <= max_rss_kb) {
+        return;
+    }
+
+    tracex(1, "RSS of %ld KB is over the limit of %ld KB", rss, max_rss_kb);
+
+    // Keep the watchdog from reporting at the same time.
+    TurnLock lock;
+
+    FrameWriter frames;
+    DocWriter &writer = begin_error_frame(frames, "memory");
+    writer.Key("rss");
+    writer.Integer(rss / 1024);
+    writer.Key("limit");
+    writer.Integer(max_rss_kb / 1024);
+    end_error_frame(frames, writer);
+
+    exit(3);
+}
+
+// A script: the commands from one `{"inputs": [...]}` message, run back to
+// back with no round trip in between.  Their output all goes into a single
+// frame, with a record for each command in "outputs"; or, when the client
+// only wants the final output, the frame is just the usual one for the last
+// command.
+static std::deque<std::string> script;
+static bool script_running = false;
+static bool script_final_only = false;
+static std::string script_input;        // the command whose output is next
+static DocWriter *script_writer = NULL; // the frame collecting the records
+
+void screen_set_partial_output(int paragraphs, int ms) {
+    trace(1, "%d, %d", paragraphs, ms);
+    partial_paragraphs = paragraphs;
+    partial_ms = ms;
+}
+
+void screen_set_buffer_limit(size_t bytes) {
+    trace(1, "%d", bytes);
+    buffer_limit = bytes;
+}
+
+// Starts the clock for the next partial frame.
+static void start_partial_clock() {
+    if (partial_ms) {
+        clock_gettime(CLOCK_MONOTONIC, &partial_since);
+    }
+}
+
+// Called as each turn starts.
+static void reset_partial_output() {
+    turn_output_sent = false;
+    start_partial_clock();
+}
+
+// Sends the complete paragraphs as a partial frame, if enough of them have
+// built up (or they've been waiting long enough, or the buffer has grown past
+// its limit).  A script's output all goes into its one frame, and in-process
+// hosts only ever get whole turns.
+static void check_partial_output() {
+    if ((!partial_paragraphs && !partial_ms && !buffer_limit) || output_handler || script_running) {
+        return;
+    }
+
+    size_t complete = screenBuffer.CompleteParagraphs();
+    if (complete == 0) {
+        return;
+    }
+
+    bool due = (partial_paragraphs && complete >= (size_t)partial_paragraphs) ||
+        (buffer_limit && screenBuffer.Bytes() > buffer_limit);
+    if (!due && partial_ms) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsedMs = (now.tv_sec - partial_since.tv_sec) * 1000 + (now.tv_nsec - partial_since.tv_nsec) / 1000000;
+        due = elapsedMs >= partial_ms;
+    }
+    if (!due) {
+        return;
+    }
+
+    trace(2, "%d paragraphs", complete);
+
+    // The watchdog may want the buffer, and the transport, at the same time.
+    TurnLock lock;
+
+    static Buffer partial;
+    partial.Empty();
+    if (screenBuffer.TakeComplete(partial) == 0) {
+        return;
+    }
+
+    static FrameWriter frames;
+    DocWriter &writer = frames.Begin();
+    announce_schema = false;
+    writer.Key("partial");
+    writer.Bool(true);
+    writer.Key("story");
+    partial.WriteJson(writer, !turn_output_sent, false, &paragraph_refs);
+    writer.EndObject();
+    frames.Write(writer);
+
+    partial.Empty();
+    turn_output_sent = true;
+    start_partial_clock();
+}
+
+// Writes a turn's status (whichever views of it were computed) and story
+// output into the current object.
+static void write_turn(DocWriter &writer, const Columns *columns, const Buffer *lines, bool ended) {
+    if ((columns || lines) && status_delta) {
+        writer.Key("status");
+        status_versions.WriteJson(writer, columns, lines);
+    } else if (columns || lines) {
+        writer.Key("status");
+        writer.BeginObject();
+        if (columns) {
+            writer.Key("columns");
+            columns->WriteJson(writer);
+        }
+        if (lines) {
+            writer.Key("lines");
+            lines->WriteJson(writer);
+        }
+        writer.EndObject();
+    }
+
+    if (output_want & WANT_STORY) {
+        writer.Key("story");
+        screenBuffer.WriteJson(writer, !turn_output_sent, true, &paragraph_refs, turn_output_sent);
+
+        if (screenBuffer.Truncated()) {
+            writer.Key("truncated");
+            writer.Bool(true);
+        }
+    }
+    if (ended) {
+        writer.Key("ended");
+        writer.Bool(true);
+    }
+}
+
+// Generate a JSON object for the output...  (`ended` when the story itself
+// has ended.)
+void generate_output(bool ended = false) {
+    trace(1, "%s", ended ? "ended" : "");
+
+    // Only the last of a script's outputs might be wanted.
+    const bool lastInScript = script.empty() || ended;
+    if (script_running && script_final_only && !lastInScript) {
+        return;
+    }
 
     // Collect status
     BlockBuf upperWindow(upper_window_buffer, upperWindowHeight);
-    Columns columns(upperWindow);
+
+    if (output_handler) {
+        Columns columns(upperWindow);
+        auto upperBuffer = upperWindow.ToBuffer();
+        output_handler(screenBuffer, columns, *upperBuffer);
+        delete upperBuffer;
+        return;
+    }
+
+    // Column inference, in particular, is skipped when nobody wants it.
+    Columns *columns = (output_want & WANT_STATUS_COLUMNS) ? new Columns(upperWindow) : NULL;
+    Buffer *upperBuffer = (output_want & WANT_STATUS_LINES) ? upperWindow.ToBuffer() : NULL;
     // std::cerr << columns << "\n";
-    auto upperBuffer = upperWindow.ToBuffer();
 
-    json_t* status = json_object();
-    json_object_set_new(status, "columns", columns.ToJson());
-    json_object_set_new(status, "lines", upperBuffer->ToJson());
-    delete upperBuffer;
-    upperBuffer = NULL;
+    if (script_running && !script_final_only) {
+        static FrameWriter scriptFrames;
+        if (!script_writer) {
+            script_writer = &scriptFrames.Begin();
+            announce_schema = false;
+            script_writer->Key("outputs");
+            script_writer->BeginArray();
+        }
 
-    // Collect story
-    json_t* story = screenBuffer.ToJson(true, true);
+        script_writer->BeginObject();
+        script_writer->Key("input");
+        script_writer->String(script_input);
+        write_turn(*script_writer, columns, upperBuffer, ended);
+        script_writer->EndObject();
+        delete columns;
+        delete upperBuffer;
+
+        if (lastInScript) {
+            script_writer->EndArray();
+            script_writer->EndObject();
+            scriptFrames.Write(*script_writer);
+            script_writer = NULL;
+            script_running = false;
+            script.clear();
+        }
+        return;
+    }
 
-    // Put it all together!
-    json_t* output = json_object();
-    json_object_set_new(output, "status", status);
-    json_object_set_new(output, "story", story);
+    static FrameWriter frames;
+    DocWriter &writer = frames.Begin();
+    announce_schema = false;
 
-    char *str = json_dumps(output, JSON_INDENT(2));
-    json_decref(output);
+    write_turn(writer, columns, upperBuffer, ended);
+    writer.EndObject();
+    delete columns;
+    delete upperBuffer;
 
-    fprintf(stdout, "%s\n", str);
-    free(str);
-    fflush(stdout);
+    frames.Write(writer);
+
+    if (script_running && lastInScript) {
+        script_running = false;
+        script.clear();
+    }
 }
 
 
@@ -138,6 +762,10 @@ void screen_link_to_story(struct z_story *story) {
     // screen interface, but this is old-school, not object-oriented C, so we'd
     // have to stash the story in a global or something.  (Or create a thunk
     // layer that the interface functions could access.)
+
+    // The story's first turn runs from here to its first request for input.
+    start_turn();
+    reset_partial_output();
 }
 
 // Called at @restart time.
@@ -163,6 +791,12 @@ int screen_close(z_ucs *error_message) {
     trace(1, "\"%s\"", debug);
     free(debug);
 
+    // A script's frame is finished off with the command that ended the
+    // story; any commands after it are dropped.
+    if (script_running) {
+        generate_output(true);
+    }
+
     if (error_message){
         char *message = dup_zucs_string_to_utf8_string(error_message);
         fprintf(stderr, "\n\n\e[38;5;1mERROR: %s\e[0m\n\n", message);
@@ -191,7 +825,24 @@ void screen_output_z_ucs(z_ucs *z_ucs_output) {
         return;
     }
 
-    screenBuffer.Append(ToUtf8(z_ucs_output), currentFormat);
+    std::string text = ToUtf8(z_ucs_output);
+    {
+        TurnLock lock;
+        screenBuffer.Append(text, currentFormat);
+    }
+
+    if (auto_continue) {
+        auto_continue_text += text;
+        if (auto_continue_text.size() > AUTO_CONTINUE_TEXT_MAX) {
+            auto_continue_text.erase(0, auto_continue_text.size() - AUTO_CONTINUE_TEXT_MAX);
+        }
+    }
+
+    if (max_rss_kb && screenBuffer.Bytes() >= next_rss_check) {
+        check_memory();
+    }
+
+    check_partial_output();
 }
 
 const std::map<std::u32string, const zscii> single_map = {
@@ -231,13 +882,298 @@ const std::map<std::u32string, const zscii> single_map = {
 // #define ZSCII_KEYPAD_8 153
 // #define ZSCII_KEYPAD_9 154
 
+// Nobody is left to talk to (or, for a batch job, there are no more
+// commands), so there's no point continuing.  An in-process session (see
+// session.h) mustn't take its host down with it, so there only the story's
+// own thread ends.
+static void input_closed() {
+    if (input_handler) {
+        tracex(1, "input closed, ending the story thread");
+        pthread_exit(NULL);
+    }
+
+    tracex(1, "input closed, exiting");
+    exit(0);
+}
+
+// Reads the next message from the transport.
+static std::string read_transport_message() {
+    std::string message;
+    if (!transport->ReadMessage(message)) {
+        input_closed();
+    }
+    return message;
+}
+
+// Reads and decodes the next input message; returns false on error.
+static bool read_input(InputMessage &message) {
+    // Plain stdin/stdout gets a transport too, as soon as there's input to
+    // read.
+    if (!transport) {
+        screen_set_transport(new StdioTransport());
+    }
+
+    if (!transport->ReadInput(message)) {
+        input_closed();
+    }
+
+    if (message.plain) {
+        return true;
+    }
+
+    if (!message.json) {
+        return false;
+    }
+
+    // What did we get?
+    if (!json_is_object(message.json)) {
+        fprintf(stderr, "ERROR: expected object!");
+        json_decref(message.json);
+        message.json = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+// Where this session may hibernate to; see screen_set_snapshot_dir().
+static std::string snapshot_dir;
+
+void screen_set_snapshot_dir(const std::string &dir) {
+    trace(1, "%s", dir.c_str());
+    snapshot_dir = dir;
+}
+
+// Saves a snapshot and, if that worked, exits; the session will be resumed
+// from the snapshot by a brand-new process.
+static void hibernate(const char *path) {
+    trace(1, "%s", path);
+
+    // The path comes in a message, so it's only believed when it's exactly
+    // the one the server would use for this session.
+    if (snapshot_dir.empty() || path != snapshot_dir + "/" + snapshot_file_name(sessionId)) {
+        fprintf(stderr, "ERROR: refusing to hibernate to \"%s\"\n", path);
+        return;
+    }
+
+    bool saved = snapshot_save(path);
+
+    json_t *output = begin_output();
+    json_object_set_new(output, "hibernated", json_boolean(saved));
+    write_output(output);
+
+    if (saved) {
+        exit(0);
+    }
+}
+
+// Forks a copy of this session, at exactly this point, for the new session
+// `id`; the socket for it arrived along with the request.  Copy-on-write means
+// the two share every page until they diverge.
+static void clone_session(const char *id) {
+    trace(1, "%s", id);
+
+    int fd = transport ? transport->TakeFd() : -1;
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: clone request without a socket\n");
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "ERROR: unable to fork clone: %s\n", strerror(errno));
+        close(fd);
+        return;
+    }
+
+    if (pid == 0) {
+        // Any input still buffered for the original stays with the original.
+        screen_set_session(id);
+        screen_set_transport(new FdTransport(fd, fd, true));
+
+        // The clone's client has never seen a status (or any story).
+        status_versions.Resync();
+        paragraph_refs.Reset();
+
+        // Let the clone's client know it's ready, and where things stand.
+        generate_output();
+        return;
+    }
+
+    close(fd);
+}
+
+// Replays the logged frames in the requested range (zero-copy, straight
+// from the mapped log), and then reports what was sent, and what's
+// available:
+//
+//   { "history": { "from": 10, "to": 20, "count": 11, "first": 1, "last": 42 } }
+//
+// The frames go out exactly as they were first sent, paragraph references
+// and status deltas included, so they can leave the client's view of either
+// out of step.  Both are therefore started over afterwards: the next frame
+// carries the whole status, and no references to anything sent earlier.
+// The report itself isn't a story frame, and so has no "seq" of its own.
+static void send_history(json_t *request) {
+    ScrollbackLog *log = scrollback_log();
+
+    json_t *from = json_object_get(request, "from");
+    json_t *to = json_object_get(request, "to");
+    uint64_t first = json_is_integer(from) && json_integer_value(from) > 0 ? json_integer_value(from) : 1;
+    uint64_t last = json_is_integer(to) && json_integer_value(to) > 0 ? json_integer_value(to) : log ? log->LastSeq() : 0;
+    trace(1, "%llu to %llu", (unsigned long long)first, (unsigned long long)last);
+
+    uint64_t count = 0;
+    if (log) {
+        for (uint64_t seq = std::max(first, log->FirstSeq()); seq <= last && seq <= log->LastSeq(); ++seq) {
+            const char *data;
+            size_t len;
+            if (!log->Frame(seq, data, len)) {
+                break;
+            }
+            if (transport) {
+                transport->WriteFrameBytes(data, len);
+            } else {
+                fwrite(data, 1, len, stdout);
+                fputc('\n', stdout);
+            }
+            ++count;
+        }
+    }
+
+    status_versions.Resync();
+    paragraph_refs.Reset();
+
+    json_t *output = begin_output();
+    json_t *summary = json_object();
+    json_object_set_new(summary, "from", json_integer(first));
+    json_object_set_new(summary, "to", json_integer(last));
+    json_object_set_new(summary, "count", json_integer(count));
+    if (log && log->LastSeq()) {
+        json_object_set_new(summary, "first", json_integer(log->FirstSeq()));
+        json_object_set_new(summary, "last", json_integer(log->LastSeq()));
+    }
+    json_object_set_new(output, "history", summary);
+    write_output(output);
+}
+
+// Parses a "want" list, like [ "story", "status.columns" ], into WANT_ bits.
+static int parse_want(json_t *want) {
+    static const std::map<std::string, int> names = {
+        { "story",          WANT_STORY },
+        { "status",         WANT_STATUS_COLUMNS | WANT_STATUS_LINES },
+        { "status.columns", WANT_STATUS_COLUMNS },
+        { "status.lines",   WANT_STATUS_LINES },
+    };
+
+    int bits = 0;
+    size_t i;
+    json_t *value;
+    json_array_foreach(want, i, value) {
+        const char *name = json_string_value(value);
+        auto found = name ? names.find(name) : names.end();
+        if (found == names.end()) {
+            fprintf(stderr, "ERROR: unknown \"want\" entry \"%s\"\n", name ? name : "(not a string)");
+            continue;
+        }
+        bits |= found->second;
+    }
+    return bits;
+}
+
+// Handles the control messages that the server sends to its sessions.
+// Returns true if the message was one of those, and so carries no input.
+static bool handle_control(json_t *input) {
+    // Output settings can be negotiated alongside input, or on their own.
+    bool settings = false;
+
+    json_t *schema = json_object_get(input, "schema");
+    if (json_is_integer(schema)) {
+        int requested = (int)json_integer_value(schema);
+        output_schema = requested < 1 ? 1 : requested > MAX_SCHEMA ? MAX_SCHEMA : requested;
+        announce_schema = true;
+        trace(1, "schema %d (asked for %d)", output_schema, requested);
+        settings = true;
+
+        // Whatever the client has is in the old schema.
+        status_versions.Resync();
+        paragraph_refs.Reset();
+    }
+
+    json_t *want = json_object_get(input, "want");
+    if (json_is_array(want)) {
+        output_want = parse_want(want);
+        trace(1, "want 0x%x", output_want);
+        settings = true;
+    }
+
+    json_t *delta = json_object_get(input, "delta");
+    if (json_is_boolean(delta)) {
+        status_delta = json_is_true(delta);
+        status_versions.Resync();
+        settings = true;
+    }
+
+    json_t *refs = json_object_get(input, "refs");
+    if (json_is_integer(refs) || json_is_boolean(refs)) {
+        json_int_t capacity = json_is_integer(refs) ? json_integer_value(refs) : json_is_true(refs) ? DEFAULT_PARAGRAPH_REFS : 0;
+        paragraph_refs.SetCapacity(capacity < 0 ? 0 : capacity > (json_int_t)MAX_PARAGRAPH_REFS ? MAX_PARAGRAPH_REFS : capacity);
+        settings = true;
+    }
+
+    json_t *ack = json_object_get(input, "ack");
+    if (json_is_integer(ack)) {
+        status_versions.Ack(json_integer_value(ack));
+        settings = true;
+    }
+
+    if (json_is_true(json_object_get(input, "resync"))) {
+        status_versions.Resync();
+        settings = true;
+    }
+
+    json_t *history = json_object_get(input, "history");
+    if (json_is_object(history)) {
+        send_history(history);
+        return true;
+    }
+
+    const char *path = json_string_value(json_object_get(input, "hibernate"));
+    if (path) {
+        hibernate(path);
+        return true;
+    }
+
+    const char *clone = json_string_value(json_object_get(input, "clone"));
+    if (clone) {
+        clone_session(clone);
+        return true;
+    }
+
+    return settings && !json_object_get(input, "input") && !json_object_get(input, "inputs");
+}
+
 // The JSON I/O may need to go elsewhere, this is a temporary stub
 int wait_for_input(bool single, zscii *dest, int max, int *elapsedTenths) {
     trace(2, "%s, (*dest), %d, (*elapsedTenths)", single ? "true" : "false", max);
 
+    end_turn();
+    check_memory();
+
+    if (first_input_hook) {
+        auto hook = first_input_hook;
+        first_input_hook = NULL;
+        hook();
+    }
+
     // std::cerr << screenBuffer << "\n";
-    generate_output();
-    screenBuffer.Empty();
+    if (suppress_next_output) {
+        // Anything left over from the snapshot goes out with the next frame.
+        suppress_next_output = false;
+    } else {
+        generate_output();
+        screenBuffer.Empty();
+    }
 
     struct timeval start;
     struct timeval end;
@@ -245,35 +1181,66 @@ int wait_for_input(bool single, zscii *dest, int max, int *elapsedTenths) {
 
     // fprintf(stderr, "\n\e[38;5;13mwaiting to read%s...\e[0m\n", single ? " (single character only!)": "");
 
-    // Extract input string...
-    std::u32string u32input;
-
-    if (use_simple_console_input) {
+    // Extract input string... (into storage that's reused turn after turn)
+    static std::u32string u32input;
+
+    if (!script.empty()) {
+        script_input = script.front();
+        script.pop_front();
+        FromUtf8(script_input.data(), script_input.size(), u32input);
+    } else if (input_handler) {
+        std::string input;
+        if (!input_handler(input)) {
+            input_closed();
+        }
+        FromUtf8(input.data(), input.size(), u32input);
+    } else if (use_simple_console_input && transport) {
+        std::string input = read_transport_message();
+        FromUtf8(input.data(), input.size(), u32input);
+    } else if (use_simple_console_input) {
         char buf[1000];
         const char * value = fgets(buf, sizeof(buf), stdin);
         if (!value) {
             tracex(1, "error reading line");
             return -1;
         }
-        u32input = FromUtf8(value);
+        FromUtf8(value, strlen(value), u32input);
     } else {
-        json_error_t error;
-        json_t *input = json_loadf(stdin, JSON_DISABLE_EOF_CHECK, &error);
-        if (!input) {
-            fprintf(stderr, "ERROR with input, line %d, column %d (position %d): %s (%s)\n", error.line, error.column, error.position, error.text, error.source);
-            return -1;
+        // Plain input (by far the most common message) never builds a
+        // document; anything else might be a control message.
+        static InputMessage input;
+        bool valid;
+        while ((valid = read_input(input)) && !input.plain && handle_control(input.json)) {
+            json_decref(input.json);
         }
 
-        // What did we get?
-        if (!json_is_object(input)) {
-            fprintf(stderr, "ERROR: expected object!");
-            json_decref(input);
+        if (!valid) {
             return -1;
         }
 
-        const char *value = json_string_value(json_object_get(input, "input"));
-        u32input = FromUtf8(value);
-        json_decref(input);
+        json_t *inputs = input.plain ? NULL : json_object_get(input.json, "inputs");
+        if (json_array_size(inputs) > 0) {
+            size_t i;
+            json_t *value;
+            json_array_foreach(inputs, i, value) {
+                const char *str = json_string_value(value);
+                script.push_back(str ? std::string(str, json_string_length(value)) : "");
+            }
+            script_running = true;
+            script_final_only = json_is_true(json_object_get(input.json, "final"));
+            json_decref(input.json);
+
+            script_input = script.front();
+            script.pop_front();
+            FromUtf8(script_input.data(), script_input.size(), u32input);
+        } else if (input.plain) {
+            FromUtf8(input.input.data(), input.input.size(), u32input);
+        } else {
+            json_t *value = json_object_get(input.json, "input");
+            const char *str = json_string_value(value);
+            FromUtf8(str ? str : "", str ? json_string_length(value) : 0, u32input);
+            json_decref(input.json);
+        }
         // strlcpy(buf, value, sizeof(buf));
     }
 
@@ -339,15 +1306,50 @@ int16_t screen_read_line(zscii *dest, uint16_t maximum_length,
         disable_command_history ? "true" : "false",
         return_on_escape? "true" : "false");
 
-    return wait_for_input(false, dest, maximum_length, tenth_seconds_elapsed);
+    auto_continued = 0;
+    auto_continue_text.clear();
+    int16_t n = wait_for_input(false, dest, maximum_length, tenth_seconds_elapsed);
+    start_turn();
+    reset_partial_output();
+    return n;
+}
+
+// The last line of `text` that isn't blank.
+static std::string last_line(const std::string &text) {
+    size_t end = text.find_last_not_of(" \t\n");
+    if (end == std::string::npos) {
+        return "";
+    }
+
+    size_t start = text.rfind('\n', end);
+    start = start == std::string::npos ? 0 : start + 1;
+    return text.substr(start, end + 1 - start);
 }
 
 int screen_read_char(uint16_t tenth_seconds,
     uint32_t verification_routine, int *tenth_seconds_elapsed) {
     trace(1, "%d, %d, (*elapsed)", tenth_seconds, verification_routine);
 
+    // A pause just carries on, as part of the same turn.  Only the last line
+    // of text printed since the previous read counts as its prompt.
+    std::string prompt = last_line(auto_continue_text);
+    auto_continue_text.clear();
+
+    if (auto_continue && auto_continued < MAX_AUTO_CONTINUES && !prompt.empty() &&
+        std::regex_search(prompt, *auto_continue)) {
+        ++auto_continued;
+        tracex(1, "auto-continuing (%d)", auto_continued);
+        if (tenth_seconds_elapsed) {
+            *tenth_seconds_elapsed = 0;
+        }
+        return ZSCII_NEWLINE;
+    }
+    auto_continued = 0;
+
     zscii buf[2];
     int n = wait_for_input(true, buf, 2, tenth_seconds_elapsed);
+    start_turn();
+    reset_partial_output();
     if (n > 0) {
         tracex(1, "returning %1$d ('%1$c')", buf[0]);
         return buf[0];
@@ -394,7 +1396,10 @@ void screen_split_window(int16_t nof_lines) {
         BlockBuf upperWindow(upper_window_buffer, upperWindowHeight);
         auto buf = upperWindow.ToBuffer();
         // std::cerr << buf << "\n";
-        screenBuffer.Prepend(*buf);
+        {
+            TurnLock lock;
+            screenBuffer.Prepend(*buf);
+        }
         delete buf;
     }
 
@@ -3,14 +3,108 @@
 #ifndef FIZMO_JSON_SCREEN_H
 #define FIZMO_JSON_SCREEN_H
 
+#include <functional>
+#include <iostream>
+#include <string>
+
 extern "C" {
     #include <screen_interface/screen_interface.h>
 }
 
+#include "buffer.h"
+#include "columns.h"
+#include "transport.h"
+
 
 extern struct z_screen_interface bot_screen;
 
 extern void screen_use_simple_console_input();
 
+// Called (once) when the story first asks for input, just before any output
+// is generated.  The zygote uses this to pause a fully-loaded story.
+extern void screen_set_first_input_hook(void (*hook)());
+
+// Reads input from, and writes (compact, single-line) output to, `transport`
+// instead of stdin/stdout.  The screen takes ownership of the transport.
+extern void screen_set_transport(Transport *transport);
+
+// For in-process hosts (see session.h): instead of generating JSON, output is
+// handed over as the story buffer and status, and input lines are requested
+// from the input handler (which returns false if there will never be any, to
+// end the story's thread there and then).
+typedef std::function<void(const Buffer &story, const Columns &columns, const Buffer &lines)> ScreenOutputHandler;
+typedef std::function<bool(std::string &input)> ScreenInputHandler;
+
+extern void screen_set_handlers(ScreenOutputHandler output, ScreenInputHandler input);
+
+// Tags every output frame with the given session id.
+extern void screen_set_session(const std::string &session);
+
+// Lets the session hibernate (see snapshot.h) when asked to, but only into
+// its own snapshot in `dir`.  Only the server sets this, for its workers;
+// elsewhere, hibernate requests are refused.
+extern void screen_set_snapshot_dir(const std::string &dir);
+
+// Limits each turn (from one request for input to the next) to `wallMs` of
+// wall-clock time and `cpuMs` of CPU time; zero means unlimited.  A turn that
+// runs over produces a final frame like:
+//
+//   { "error": { "type": "timeout", "budget": "wall", "limit": 5000 },
+//     "story": [ ...whatever the turn had output so far... ] }
+//
+// and the process exits.
+extern void screen_set_turn_budget(int wallMs, int cpuMs);
+
+// Caps each turn's story output at `maxOutputBytes` (the frame is then marked
+// with "truncated": true), and the whole process at `maxRssMb` of resident
+// memory; a process over that produces a final frame like:
+//
+//   { "error": { "type": "memory", "rss": 530, "limit": 512 },
+//     "story": [ ...whatever the turn had output so far... ] }
+//
+// and exits.  Zero means no limit.
+extern void screen_set_memory_limits(size_t maxOutputBytes, long maxRssMb);
+
+// Streams long runs of story output instead of holding all of it until the
+// story next waits for input: once `paragraphs` complete paragraphs have
+// built up, or `ms` milliseconds have passed with at least one, they're sent
+// straight away in a frame like:
+//
+//   { "partial": true, "story": [ ...the complete paragraphs... ] }
+//
+// The frame at the next request for input still carries the rest of the
+// story output, and the status.  Zero turns either threshold off.
+extern void screen_set_partial_output(int paragraphs, int ms);
+
+// Bounds the story buffer: once it holds more than `bytes`, its complete
+// paragraphs are sent as a partial frame (as above) and dropped, whatever
+// the partial output settings.  Zero means no bound.  (A single paragraph
+// that never ends can still grow without bound; see the `maxOutputBytes`
+// of screen_set_memory_limits().)
+extern void screen_set_buffer_limit(size_t bytes);
+
+// Answers single-key reads automatically (with "enter") when the last line
+// the story has printed since its previous read matches `pattern`, a
+// case-insensitive ECMAScript regex, so that pauses like "[Press any key to
+// continue]" don't each cost a frame and a round trip; their output is folded
+// into the next frame instead.  Without new output, a read is never answered
+// again.  A NULL pattern uses a default that covers the common "press any
+// key" and [MORE] prompts.  Returns false (after reporting the problem) for a
+// bad pattern.
+extern bool screen_set_auto_continue(const char *pattern);
+
+// Numbers every output frame ("seq") and keeps it in a per-session
+// scrollback log in `dir` (see scrollback.h), from which a client can fetch
+// any range of frames again with `{ "history": { "from": 10, "to": 20 } }`.
+// Frames are replayed as first sent; afterwards, status deltas and paragraph
+// references start over, as they do for a new client.
+extern void screen_set_scrollback(const std::string &dir);
+
+// Snapshot support: the front-end state that the Z-machine's own save file
+// doesn't cover.  Loading state also suppresses the next output frame, since
+// the client saw it before the session was hibernated.
+extern void screen_save_state(std::ostream &os);
+extern bool screen_load_state(std::istream &is);
+
 
 #endif // FIZMO_JSON_SCREEN_H
@@ -0,0 +1,195 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "scrollback.h"
+
+extern "C" {
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <stdio.h>
+    #include <string.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+}
+
+#include "util.h"
+
+
+// The file grows in steps of at least this much, so that remapping is rare.
+static const size_t SCROLLBACK_GROWTH = 1024 * 1024;
+
+static size_t padded(size_t len) {
+    return (len + 7) & ~(size_t)7;
+}
+
+
+ScrollbackLog *ScrollbackLog::Open(const std::string &path) {
+    trace(1, "%s", path.c_str());
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: unable to open scrollback log %s: %s\n", path.c_str(), strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "ERROR: unable to open scrollback log %s: %s\n", path.c_str(), strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    // A brand-new log gets its header (and some room).
+    size_t size = st.st_size;
+    const bool created = size == 0;
+    if (created) {
+        size = SCROLLBACK_GROWTH;
+        if (ftruncate(fd, size) < 0) {
+            fprintf(stderr, "ERROR: unable to size scrollback log %s: %s\n", path.c_str(), strerror(errno));
+            close(fd);
+            return NULL;
+        }
+    }
+
+    if (size < sizeof(ScrollbackHeader)) {
+        fprintf(stderr, "ERROR: %s isn't a fizmo-json scrollback log\n", path.c_str());
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "ERROR: unable to map scrollback log %s: %s\n", path.c_str(), strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    ScrollbackHeader *header = (ScrollbackHeader *)base;
+    if (created) {
+        header->magic = SCROLLBACK_MAGIC;
+        header->version = SCROLLBACK_VERSION;
+        header->used = sizeof(ScrollbackHeader);
+    } else if (header->magic != SCROLLBACK_MAGIC || header->version != SCROLLBACK_VERSION ||
+        header->used < sizeof(ScrollbackHeader) || header->used > size) {
+        fprintf(stderr, "ERROR: %s isn't a fizmo-json scrollback log\n", path.c_str());
+        munmap(base, size);
+        close(fd);
+        return NULL;
+    }
+
+    return new ScrollbackLog(fd, (char *)base, size);
+}
+
+ScrollbackLog::ScrollbackLog(int fd, char *base, size_t size)
+: fd_(fd), base_(base), size_(size), firstSeq_(0) {
+    trace(2, "[%p] %d, %p, %d", this, fd, base, size);
+
+    // Index the records that are already there; anything that doesn't add up
+    // (a torn final record) is dropped.
+    const uint64_t used = Header()->used;
+    uint64_t offset = sizeof(ScrollbackHeader);
+    while (offset + sizeof(ScrollbackRecord) <= used) {
+        const ScrollbackRecord *record = (const ScrollbackRecord *)(base_ + offset);
+        if (record->length > used - offset - sizeof(ScrollbackRecord)) {
+            break;
+        }
+        const uint64_t next = offset + sizeof(ScrollbackRecord) + padded(record->length);
+        if (next > used || (firstSeq_ && record->seq != firstSeq_ + offsets_.size())) {
+            break;
+        }
+        if (!firstSeq_) {
+            firstSeq_ = record->seq;
+        }
+        offsets_.push_back(offset);
+        offset = next;
+    }
+    Header()->used = offset;
+}
+
+ScrollbackLog::~ScrollbackLog() {
+    trace(2, "[%p]", this);
+    munmap(base_, size_);
+    close(fd_);
+}
+
+ScrollbackHeader *ScrollbackLog::Header() const {
+    return (ScrollbackHeader *)base_;
+}
+
+uint64_t ScrollbackLog::NextSeq() const {
+    return firstSeq_ ? firstSeq_ + offsets_.size() : 1;
+}
+
+uint64_t ScrollbackLog::FirstSeq() const {
+    return firstSeq_;
+}
+
+uint64_t ScrollbackLog::LastSeq() const {
+    return firstSeq_ ? firstSeq_ + offsets_.size() - 1 : 0;
+}
+
+bool ScrollbackLog::Reserve(size_t needed) {
+    if (needed <= size_) {
+        return true;
+    }
+
+    size_t size = size_ * 2;
+    if (size < needed + SCROLLBACK_GROWTH) {
+        size = needed + SCROLLBACK_GROWTH;
+    }
+
+    if (ftruncate(fd_, size) < 0) {
+        tracex(1, "unable to grow scrollback log: %s", strerror(errno));
+        return false;
+    }
+
+    void *base = mremap(base_, size_, size, MREMAP_MAYMOVE);
+    if (base == MAP_FAILED) {
+        tracex(1, "unable to remap scrollback log: %s", strerror(errno));
+        return false;
+    }
+
+    base_ = (char *)base;
+    size_ = size;
+    return true;
+}
+
+bool ScrollbackLog::Append(uint64_t seq, const std::string &frame) {
+    trace(3, "[%p] %llu, %d bytes", this, (unsigned long long)seq, frame.size());
+
+    if (seq != NextSeq() && !offsets_.empty()) {
+        return false;
+    }
+
+    const uint64_t offset = Header()->used;
+    const uint64_t next = offset + sizeof(ScrollbackRecord) + padded(frame.size());
+    if (!Reserve(next)) {
+        return false;
+    }
+
+    ScrollbackRecord *record = (ScrollbackRecord *)(base_ + offset);
+    record->seq = seq;
+    record->length = frame.size();
+    record->reserved = 0;
+    memcpy(record + 1, frame.data(), frame.size());
+
+    // Only once the record is complete does it count.
+    Header()->used = next;
+
+    if (!firstSeq_) {
+        firstSeq_ = seq;
+    }
+    offsets_.push_back(offset);
+    return true;
+}
+
+bool ScrollbackLog::Frame(uint64_t seq, const char *&data, size_t &len) const {
+    if (!firstSeq_ || seq < firstSeq_ || seq > LastSeq()) {
+        return false;
+    }
+
+    const ScrollbackRecord *record = (const ScrollbackRecord *)(base_ + offsets_[seq - firstSeq_]);
+    data = (const char *)(record + 1);
+    len = record->length;
+    return true;
+}
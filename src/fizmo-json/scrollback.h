@@ -0,0 +1,68 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_SCROLLBACK_H
+#define FIZMO_JSON_SCROLLBACK_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// A session's output frames, numbered and kept in an append-only file that's
+// mapped into memory, so that a client that reconnects (or a gateway that
+// restarts) can fetch whatever it missed.  Reading a frame back is just a
+// pointer into the mapping.
+//
+// The file starts with a `ScrollbackHeader`, followed by the records, each a
+// `ScrollbackRecord` and then the frame itself, padded to 8 bytes.  The
+// header's `used` counts the bytes of complete records; the file itself is
+// grown ahead of that in large steps.  Sequence numbers are consecutive, and
+// reopening a log carries on after its last frame.
+struct ScrollbackHeader {
+    uint32_t    magic;      // SCROLLBACK_MAGIC
+    uint32_t    version;    // SCROLLBACK_VERSION
+    uint64_t    used;
+};
+
+struct ScrollbackRecord {
+    uint64_t    seq;
+    uint32_t    length;
+    uint32_t    reserved;
+};
+
+const uint32_t SCROLLBACK_MAGIC = 0x4c4a5a46;   // "FZJL"
+const uint32_t SCROLLBACK_VERSION = 1;
+
+
+class ScrollbackLog {
+  public:
+    // Opens (or creates) the log at `path`; returns NULL on failure.
+    static ScrollbackLog *Open(const std::string &path);
+    ~ScrollbackLog();
+
+    // The sequence number the next frame will get.
+    uint64_t NextSeq() const;
+
+    // The oldest and newest frames' sequence numbers (zero when empty).
+    uint64_t FirstSeq() const;
+    uint64_t LastSeq() const;
+
+    bool Append(uint64_t seq, const std::string &frame);
+
+    // Points `data` at frame `seq`, which stays valid until the next Append().
+    bool Frame(uint64_t seq, const char *&data, size_t &len) const;
+
+  private:
+    ScrollbackLog(int fd, char *base, size_t size);
+
+    bool Reserve(size_t needed);
+    ScrollbackHeader *Header() const;
+
+    int                     fd_;
+    char                    *base_;
+    size_t                  size_;
+    uint64_t                firstSeq_;
+    std::vector<uint64_t>   offsets_;   // of each record, from firstSeq_ on
+};
+
+#endif // FIZMO_JSON_SCROLLBACK_H
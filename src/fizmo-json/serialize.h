@@ -0,0 +1,37 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_SERIALIZE_H
+#define FIZMO_JSON_SERIALIZE_H
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// Tiny helpers for the snapshot format.  The values are written in native
+// byte order, because a snapshot is only ever read back on the same host.
+
+template <typename T>
+inline void SaveValue(std::ostream &os, const T &value) {
+    os.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T>
+inline bool LoadValue(std::istream &is, T &value) {
+    return (bool)is.read(reinterpret_cast<char *>(&value), sizeof(value));
+}
+
+inline void SaveString(std::ostream &os, const std::string &str) {
+    SaveValue(os, (uint32_t)str.size());
+    os.write(str.data(), str.size());
+}
+
+inline bool LoadString(std::istream &is, std::string &str) {
+    uint32_t size;
+    if (!LoadValue(is, size)) {
+        return false;
+    }
+    str.resize(size);
+    return (bool)is.read(&str[0], size);
+}
+
+#endif // FIZMO_JSON_SERIALIZE_H
@@ -0,0 +1,917 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "server.h"
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+
+extern "C" {
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <signal.h>
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <string.h>
+    #include <time.h>
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <jansson.h>
+}
+
+#include "ipc.h"
+#include "screen.h"
+#include "snapshot.h"
+#include "story.h"
+#include "transport.h"
+#include "util.h"
+#include "zygote.h"
+
+
+static std::string snapshotDir;
+static int idleTimeout = 0;
+static int maxLive = 0;
+static int minFree = 0;
+
+void server_set_hibernation(const std::string &dir, int idleSeconds, int maxLiveSessions, int minFreeMb) {
+    trace(1, "%s, %d, %d, %d", dir.c_str(), idleSeconds, maxLiveSessions, minFreeMb);
+    snapshotDir = dir;
+    idleTimeout = idleSeconds;
+    maxLive = maxLiveSessions;
+    minFree = minFreeMb;
+}
+
+static bool hibernation_enabled() {
+    return idleTimeout > 0 || maxLive > 0 || minFree > 0;
+}
+
+static time_t now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// The kernel's estimate of how much memory could be used without swapping,
+// or -1 if it can't be determined.
+static long available_memory_mb() {
+    FILE *meminfo = fopen("/proc/meminfo", "r");
+    if (!meminfo) {
+        return -1;
+    }
+
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), meminfo)) {
+        if (sscanf(line, "MemAvailable: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(meminfo);
+
+    return kb < 0 ? -1 : kb / 1024;
+}
+
+// An observer that falls this far behind stops observing, rather than let
+// its backlog grow without bound.
+static const size_t OBSERVER_BACKLOG_LIMIT = 1024 * 1024;
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+
+// One end of a stream that the server both reads messages from and queues
+// frames for.  Client connections and session workers are both peers; all
+// writes are non-blocking, so one slow reader never holds up the others.
+class Peer {
+  public:
+    Peer(int fd);
+    ~Peer();
+
+    int Fd() const;
+    FdTransport &Reader();
+
+    // Queues a frame, optionally passing a file descriptor along with it
+    // (which the peer then owns).
+    void Queue(const std::string &frame, int fd = -1);
+
+    // Queues bytes that are already framed for the wire; the same buffer
+    // can be shared by every peer that a frame is fanned out to.
+    void QueueShared(const std::shared_ptr<const std::string> &bytes);
+
+    bool Pending() const;
+    size_t PendingBytes() const;
+
+    // Writes as much of the queue as the socket will take; false on error.
+    bool Flush();
+
+  private:
+    struct Chunk {
+        std::shared_ptr<const std::string> bytes;
+        int         fd;
+    };
+
+    int                     fd_;
+    FdTransport             reader_;
+    std::deque<Chunk>       out_;
+    size_t                  written_;
+    size_t                  pendingBytes_;
+};
+
+Peer::Peer(int fd)
+: fd_(fd), reader_(fd, fd), written_(0), pendingBytes_(0) {
+    trace(2, "[%p] %d", this, fd);
+    set_nonblocking(fd);
+}
+
+Peer::~Peer() {
+    trace(2, "[%p] %d", this, fd_);
+    for (const auto &chunk : out_) {
+        if (chunk.fd >= 0) {
+            close(chunk.fd);
+        }
+    }
+    close(fd_);
+}
+
+int Peer::Fd() const {
+    return fd_;
+}
+
+FdTransport &Peer::Reader() {
+    return reader_;
+}
+
+void Peer::Queue(const std::string &frame, int fd) {
+    trace(3, "[%p] %d bytes, %d", this, frame.size(), fd);
+    auto bytes = std::make_shared<const std::string>(reader_.Frame(frame));
+    pendingBytes_ += bytes->size();
+    out_.push_back({ bytes, fd });
+}
+
+void Peer::QueueShared(const std::shared_ptr<const std::string> &bytes) {
+    trace(3, "[%p] %d bytes (shared)", this, bytes->size());
+    pendingBytes_ += bytes->size();
+    out_.push_back({ bytes, -1 });
+}
+
+bool Peer::Pending() const {
+    return !out_.empty();
+}
+
+size_t Peer::PendingBytes() const {
+    return pendingBytes_ - written_;
+}
+
+bool Peer::Flush() {
+    while (!out_.empty()) {
+        Chunk &front = out_.front();
+        const bool passFd = front.fd >= 0;
+        const std::string &bytes = *front.bytes;
+        ssize_t n = ipc_send_some(fd_, bytes.data() + written_, bytes.size() - written_, passFd ? &front.fd : NULL, passFd ? 1 : 0);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+
+        if (passFd && n > 0) {
+            // The other end has its own copy now.
+            close(front.fd);
+            front.fd = -1;
+        }
+
+        written_ += n;
+        if (written_ == bytes.size()) {
+            pendingBytes_ -= bytes.size();
+            out_.pop_front();
+            written_ = 0;
+        }
+    }
+    return true;
+}
+
+
+struct Session {
+    std::string id;
+    std::string story;
+    Peer        *worker;    // NULL while hibernated
+    Peer        *owner;     // the connection that most recently spoke for it
+
+    time_t      lastActive;
+    bool        hibernating;
+    std::deque<std::string> backlog;   // messages that arrived mid-hibernation
+    std::vector<std::string> clones;   // clones to make from the snapshot
+    std::vector<Peer *> observers;     // read-only connections watching it
+};
+
+
+class Server {
+  public:
+    Server(const std::vector<Preloader *> &preloaders);
+
+    int Run(int listener);
+
+  private:
+    void Accept(int listener);
+    void ReadConnection(Peer *conn);
+    void ReadWorker(Session *session);
+    void HandleMessage(Peer *conn, const std::string &message);
+    Session *StartSession(Peer *conn, const std::string &id, const char *story);
+    void EndSession(Session *session);
+    void DropConnection(Peer *conn);
+    void Reply(Peer *conn, const std::string &session, const char *key, json_t *value);
+    void Observe(Peer *conn, Session *session, bool observe);
+    void Broadcast(Session *session, const std::string &frame);
+
+    void Deliver(Session *session, const std::string &message);
+    void Clone(Peer *conn, Session *source, const std::string &id);
+    Session *CloneSnapshot(Session *source, const std::string &id);
+    void FinishClones(Session *source);
+    void Hibernate(Session *session);
+    void HibernateIdle();
+    bool Resume(Session *session);
+    std::string SnapshotPath(const Session *session) const;
+
+    int                             listener_;
+    std::vector<Preloader *>        preloaders_;
+    std::map<int, Peer *>           connections_;
+    std::map<std::string, Session*> sessions_;
+    std::map<int, Session *>        workers_;     // keyed by worker fd
+};
+
+Server::Server(const std::vector<Preloader *> &preloaders)
+: listener_(-1), preloaders_(preloaders) {
+    trace(2, "[%p] %d preloaders", this, preloaders.size());
+}
+
+int Server::Run(int listener) {
+    trace(1, "[%p] %d", this, listener);
+
+    listener_ = listener;
+    std::vector<struct pollfd> fds;
+
+    for (;;) {
+        fds.clear();
+        fds.push_back({ listener, POLLIN, 0 });
+        for (const auto &c : connections_) {
+            fds.push_back({ c.first, (short)(POLLIN | (c.second->Pending() ? POLLOUT : 0)), 0 });
+        }
+        for (const auto &w : workers_) {
+            fds.push_back({ w.first, (short)(POLLIN | (w.second->worker->Pending() ? POLLOUT : 0)), 0 });
+        }
+
+        // Hibernation needs to wake up now and then to look for idle
+        // sessions; a second's precision is plenty.
+        if (poll(fds.data(), fds.size(), hibernation_enabled() ? 1000 : -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: poll failed: %s\n", strerror(errno));
+            return -1;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            Accept(listener);
+        }
+
+        // Handling one descriptor can close others, so everything is looked
+        // up afresh rather than trusted from the poll list.
+        for (size_t i = 1; i < fds.size(); i++) {
+            const short revents = fds[i].revents;
+            if (!revents) {
+                continue;
+            }
+
+            auto conn = connections_.find(fds[i].fd);
+            if (conn != connections_.end()) {
+                if ((revents & POLLOUT) && !conn->second->Flush()) {
+                    DropConnection(conn->second);
+                } else if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                    ReadConnection(conn->second);
+                }
+                continue;
+            }
+
+            auto worker = workers_.find(fds[i].fd);
+            if (worker != workers_.end()) {
+                if ((revents & POLLOUT) && !worker->second->worker->Flush()) {
+                    EndSession(worker->second);
+                } else if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                    ReadWorker(worker->second);
+                }
+            }
+        }
+
+        // Opportunistically push out anything queued during this pass.
+        for (auto c = connections_.begin(); c != connections_.end(); ) {
+            Peer *peer = (c++)->second;
+            if (!peer->Flush()) {
+                DropConnection(peer);
+            }
+        }
+        for (auto w = workers_.begin(); w != workers_.end(); ) {
+            Session *session = (w++)->second;
+            if (!session->worker->Flush()) {
+                EndSession(session);
+            }
+        }
+
+        if (hibernation_enabled()) {
+            HibernateIdle();
+        }
+    }
+}
+
+void Server::Accept(int listener) {
+    int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        tracex(1, "accept failed: %s", strerror(errno));
+        return;
+    }
+
+    tracex(1, "accepted connection %d", fd);
+    connections_[fd] = new Peer(fd);
+}
+
+void Server::ReadConnection(Peer *conn) {
+    ssize_t n = conn->Reader().Fill();
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+
+    std::string message;
+    while (conn->Reader().Next(message)) {
+        if (!message.empty()) {
+            HandleMessage(conn, message);
+        }
+    }
+
+    if (n <= 0 || conn->Reader().Broken()) {
+        DropConnection(conn);
+    }
+}
+
+void Server::ReadWorker(Session *session) {
+    ssize_t n = session->worker->Reader().Fill();
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+
+    // Workers tag their own frames, so they are passed along untouched.
+    std::string frame;
+    while (session->worker->Reader().Next(frame)) {
+        if (session->hibernating) {
+            // The acknowledgement of a hibernate request is just for us.
+            json_t *ack = json_loads(frame.c_str(), 0, NULL);
+            json_t *hibernated = json_object_get(ack, "hibernated");
+            bool failed = hibernated && !json_is_true(hibernated);
+            bool isAck = hibernated != NULL;
+            json_decref(ack);
+
+            if (failed) {
+                tracex(1, "session %s failed to hibernate", session->id.c_str());
+                session->hibernating = false;
+                while (!session->backlog.empty()) {
+                    session->worker->Queue(session->backlog.front());
+                    session->backlog.pop_front();
+                }
+
+                // Clones that were waiting for the snapshot can just be
+                // forked from the (still live) worker instead.
+                std::vector<std::string> clones;
+                clones.swap(session->clones);
+                for (const auto &id : clones) {
+                    auto placeholder = sessions_.find(id);
+                    if (placeholder == sessions_.end()) {
+                        continue;
+                    }
+                    // (The owner may have disconnected in the meantime.)
+                    Peer *owner = placeholder->second->owner;
+                    std::deque<std::string> backlog;
+                    backlog.swap(placeholder->second->backlog);
+                    delete placeholder->second;
+                    sessions_.erase(placeholder);
+
+                    Clone(owner, session, id);
+                    auto clone = sessions_.find(id);
+                    if (clone == sessions_.end()) {
+                        continue;
+                    }
+                    for (const auto &message : backlog) {
+                        Deliver(clone->second, message);
+                    }
+                }
+            }
+            if (isAck) {
+                continue;
+            }
+        }
+
+        Broadcast(session, frame);
+    }
+
+    if (n <= 0 || session->worker->Reader().Broken()) {
+        EndSession(session);
+    }
+}
+
+void Server::HandleMessage(Peer *conn, const std::string &message) {
+    trace(2, "[%p] %p, \"%s\"", this, conn, message.c_str());
+
+    json_error_t error;
+    json_t *msg = json_loads(message.c_str(), 0, &error);
+    if (!json_is_object(msg)) {
+        Reply(conn, "", "error", json_string(msg ? "expected object" : error.text));
+        json_decref(msg);
+        return;
+    }
+
+    const char *id = json_string_value(json_object_get(msg, "session"));
+    if (!id || !*id) {
+        Reply(conn, "", "error", json_string("missing session"));
+        json_decref(msg);
+        return;
+    }
+
+    // Hibernation is the server's business alone.
+    if (json_object_get(msg, "hibernate")) {
+        Reply(conn, id, "error", json_string("hibernate is not a client request"));
+        json_decref(msg);
+        return;
+    }
+
+    const char *cloneId = json_string_value(json_object_get(msg, "clone"));
+    if (cloneId) {
+        auto source = sessions_.find(id);
+        if (source == sessions_.end()) {
+            Reply(conn, id, "error", json_string("unknown session"));
+        } else if (!*cloneId || sessions_.count(cloneId)) {
+            Reply(conn, cloneId, "error", json_string("session already exists"));
+        } else {
+            Clone(conn, source->second, cloneId);
+        }
+        json_decref(msg);
+        return;
+    }
+
+    json_t *observe = json_object_get(msg, "observe");
+    if (observe) {
+        auto found = sessions_.find(id);
+        if (found == sessions_.end()) {
+            Reply(conn, id, "error", json_string("unknown session"));
+        } else {
+            Observe(conn, found->second, json_is_true(observe));
+        }
+        json_decref(msg);
+        return;
+    }
+
+    Session *session;
+    auto found = sessions_.find(id);
+    if (found != sessions_.end()) {
+        session = found->second;
+    } else {
+        session = StartSession(conn, id, json_string_value(json_object_get(msg, "story")));
+        if (!session) {
+            Reply(conn, id, "error", json_string("unknown story"));
+            json_decref(msg);
+            return;
+        }
+
+        // A message that only names the session just starts it; the opening
+        // text is on its way.
+        if (!json_object_get(msg, "input")) {
+            json_decref(msg);
+            return;
+        }
+    }
+
+    json_decref(msg);
+
+    session->owner = conn;
+    Deliver(session, message);
+}
+
+void Server::Deliver(Session *session, const std::string &message) {
+    session->lastActive = now_seconds();
+
+    if (session->hibernating) {
+        session->backlog.push_back(message);
+        return;
+    }
+
+    if (!session->worker && !Resume(session)) {
+        if (session->owner) {
+            Reply(session->owner, session->id, "error", json_string("unable to resume session"));
+        }
+        return;
+    }
+
+    session->worker->Queue(message);
+}
+
+// A live session is cloned by the worker itself: it forks at the point where
+// it's waiting for input, and the child takes over the socket we pass along
+// with the request.  The two then share all of their memory, copy-on-write,
+// until they diverge.
+void Server::Clone(Peer *conn, Session *source, const std::string &id) {
+    trace(1, "[%p] %p, \"%s\", \"%s\"", this, conn, source->id.c_str(), id.c_str());
+
+    if (!source->worker || source->hibernating) {
+        // A hibernated session is cloned by copying its snapshot.  For one
+        // that's on its way there, the clone is a placeholder (which queues
+        // messages just like a hibernating session) until the snapshot
+        // arrives.
+        if (source->hibernating) {
+            source->clones.push_back(id);
+            sessions_[id] = new Session{ id, source->story, NULL, conn, now_seconds(), true };
+        } else if (!CloneSnapshot(source, id)) {
+            if (conn) {
+                Reply(conn, id, "error", json_string("unable to clone session"));
+            }
+            return;
+        }
+        sessions_[id]->owner = conn;
+        if (conn) {
+            Reply(conn, id, "cloned", json_string(source->id.c_str()));
+        }
+        return;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        fprintf(stderr, "ERROR: unable to create session socket: %s\n", strerror(errno));
+        if (conn) {
+            Reply(conn, id, "error", json_string("unable to clone session"));
+        }
+        return;
+    }
+
+    json_t *request = json_object();
+    json_object_set_new(request, "clone", json_string(id.c_str()));
+    char *str = json_dumps(request, JSON_COMPACT);
+    json_decref(request);
+    source->worker->Queue(str, sv[1]);
+    free(str);
+
+    source->lastActive = now_seconds();
+
+    auto session = new Session{ id, source->story, new Peer(sv[0]), conn, now_seconds(), false };
+    sessions_[id] = session;
+    workers_[sv[0]] = session;
+}
+
+void Server::FinishClones(Session *source) {
+    trace(1, "[%p] \"%s\"", this, source->id.c_str());
+
+    std::vector<std::string> clones;
+    clones.swap(source->clones);
+
+    for (const auto &id : clones) {
+        auto found = sessions_.find(id);
+        if (found == sessions_.end()) {
+            continue;
+        }
+
+        Session *clone = found->second;
+        if (!snapshot_copy(SnapshotPath(source), SnapshotPath(clone))) {
+            if (clone->owner) {
+                Reply(clone->owner, id, "error", json_string("unable to clone session"));
+            }
+            sessions_.erase(found);
+            delete clone;
+            continue;
+        }
+
+        clone->hibernating = false;
+        FinishClones(clone);
+
+        std::deque<std::string> backlog;
+        backlog.swap(clone->backlog);
+        for (const auto &message : backlog) {
+            Deliver(clone, message);
+        }
+    }
+}
+
+Session *Server::CloneSnapshot(Session *source, const std::string &id) {
+    trace(1, "[%p] \"%s\", \"%s\"", this, source->id.c_str(), id.c_str());
+
+    auto session = new Session{ id, source->story, NULL, source->owner, now_seconds(), false };
+    if (!snapshot_copy(SnapshotPath(source), SnapshotPath(session))) {
+        delete session;
+        return NULL;
+    }
+
+    sessions_[id] = session;
+    return session;
+}
+
+std::string Server::SnapshotPath(const Session *session) const {
+    return snapshotDir + "/" + snapshot_file_name(session->id);
+}
+
+void Server::Hibernate(Session *session) {
+    trace(1, "[%p] \"%s\"", this, session->id.c_str());
+
+    json_t *request = json_object();
+    json_object_set_new(request, "hibernate", json_string(SnapshotPath(session).c_str()));
+    char *str = json_dumps(request, JSON_COMPACT);
+    json_decref(request);
+
+    session->hibernating = true;
+    session->worker->Queue(str);
+    free(str);
+}
+
+void Server::HibernateIdle() {
+    const time_t now = now_seconds();
+    std::vector<Session *> live;
+    for (const auto &w : workers_) {
+        if (!w.second->hibernating) {
+            live.push_back(w.second);
+        }
+    }
+
+    // Least-recently-used first...
+    std::sort(live.begin(), live.end(), [](const Session *a, const Session *b) {
+        return a->lastActive < b->lastActive;
+    });
+
+    size_t evict = 0;
+    if (maxLive > 0 && live.size() > (size_t)maxLive) {
+        evict = live.size() - maxLive;
+    }
+    if (minFree > 0 && evict == 0 && !live.empty()) {
+        long available = available_memory_mb();
+        if (available >= 0 && available < minFree) {
+            tracex(1, "only %ld MB available", available);
+            evict = 1;
+        }
+    }
+
+    for (size_t i = 0; i < live.size(); i++) {
+        if (i < evict || (idleTimeout > 0 && now - live[i]->lastActive >= idleTimeout)) {
+            Hibernate(live[i]);
+        }
+    }
+}
+
+// Resumes a hibernated session in a brand-new worker.  Unlike fresh sessions,
+// this can't come from a preloader (fizmo can only restore a save as it
+// starts), so the server forks the worker itself.
+bool Server::Resume(Session *session) {
+    trace(1, "[%p] \"%s\"", this, session->id.c_str());
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        fprintf(stderr, "ERROR: unable to create session socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    const std::string path = SnapshotPath(session);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "ERROR: unable to fork session: %s\n", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        // None of the server's descriptors belong to this worker.
+        close(sv[0]);
+        close(listener_);
+        for (const auto &c : connections_) {
+            close(c.first);
+        }
+        for (const auto &w : workers_) {
+            close(w.first);
+        }
+        zygote_close_controls();
+
+        screen_set_session(session->id);
+        screen_set_snapshot_dir(snapshotDir);
+        screen_set_transport(new FdTransport(sv[1], sv[1], true));
+        if (!snapshot_load(path)) {
+            _exit(1);
+        }
+
+        std::string restore = snapshot_story_file(path);
+        story_run(session->story.c_str(), restore.c_str());
+        exit(0);
+    }
+
+    close(sv[1]);
+    session->worker = new Peer(sv[0]);
+    workers_[sv[0]] = session;
+    return true;
+}
+
+// In server mode, each session is a worker that talks compact JSON over its
+// own socket pair to the server.
+static void server_session_setup(json_t *request, const int *fds, int nfds) {
+    trace(1, "%p, %d", request, nfds);
+
+    if (nfds < 1) {
+        fprintf(stderr, "ERROR: spawn request without a socket\n");
+        _exit(1);
+    }
+
+    for (int i = 1; i < nfds; i++) {
+        close(fds[i]);
+    }
+
+    const char *id = json_string_value(json_object_get(request, "session"));
+    screen_set_session(id ? id : "");
+    screen_set_snapshot_dir(snapshotDir);
+    screen_set_transport(new FdTransport(fds[0], fds[0], true));
+}
+
+Session *Server::StartSession(Peer *conn, const std::string &id, const char *story) {
+    trace(1, "[%p] %p, \"%s\", %s", this, conn, id.c_str(), story ? story : "(NULL)");
+
+    Preloader *preloader = zygote_find(preloaders_, story);
+    if (!preloader) {
+        return NULL;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        fprintf(stderr, "ERROR: unable to create session socket: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    json_t *request = json_object();
+    json_object_set_new(request, "session", json_string(id.c_str()));
+    bool spawned = preloader->Spawn(request, &sv[1], 1);
+    json_decref(request);
+    close(sv[1]);
+
+    if (!spawned) {
+        close(sv[0]);
+        return NULL;
+    }
+
+    auto session = new Session{ id, preloader->Story(), new Peer(sv[0]), conn, now_seconds(), false };
+    sessions_[id] = session;
+    workers_[sv[0]] = session;
+    return session;
+}
+
+void Server::EndSession(Session *session) {
+    trace(1, "[%p] \"%s\"", this, session->id.c_str());
+
+    workers_.erase(session->worker->Fd());
+    delete session->worker;
+    session->worker = NULL;
+
+    if (session->hibernating) {
+        // The worker exited after saving its snapshot; it will be resumed
+        // when it's next needed (which may be right away).
+        tracex(1, "session %s hibernated", session->id.c_str());
+        session->hibernating = false;
+
+        FinishClones(session);
+        if (!session->backlog.empty()) {
+            std::deque<std::string> backlog;
+            backlog.swap(session->backlog);
+            for (const auto &message : backlog) {
+                Deliver(session, message);
+            }
+        }
+        return;
+    }
+
+    if (session->owner) {
+        Reply(session->owner, session->id, "closed", json_true());
+    }
+    for (Peer *observer : session->observers) {
+        if (observer != session->owner) {
+            Reply(observer, session->id, "closed", json_true());
+        }
+    }
+
+    if (hibernation_enabled()) {
+        snapshot_remove(SnapshotPath(session));
+    }
+
+    sessions_.erase(session->id);
+    delete session;
+}
+
+void Server::DropConnection(Peer *conn) {
+    trace(1, "[%p] %d", this, conn->Fd());
+
+    // The sessions carry on; their output is dropped until some connection
+    // speaks for them again.
+    for (auto &s : sessions_) {
+        if (s.second->owner == conn) {
+            s.second->owner = NULL;
+        }
+        auto &observers = s.second->observers;
+        observers.erase(std::remove(observers.begin(), observers.end(), conn), observers.end());
+    }
+
+    connections_.erase(conn->Fd());
+    delete conn;
+}
+
+void Server::Reply(Peer *conn, const std::string &session, const char *key, json_t *value) {
+    json_t *obj = json_object();
+    if (!session.empty()) {
+        json_object_set_new(obj, "session", json_string(session.c_str()));
+    }
+    json_object_set_new(obj, key, value);
+
+    char *str = json_dumps(obj, JSON_COMPACT);
+    json_decref(obj);
+    conn->Queue(str);
+    free(str);
+}
+
+void Server::Observe(Peer *conn, Session *session, bool observe) {
+    trace(1, "[%p] %d, \"%s\", %d", this, conn->Fd(), session->id.c_str(), observe);
+
+    auto &observers = session->observers;
+    observers.erase(std::remove(observers.begin(), observers.end(), conn), observers.end());
+    if (observe) {
+        observers.push_back(conn);
+    }
+
+    Reply(conn, session->id, "observing", json_boolean(observe));
+}
+
+// Every frame is framed for the wire once, and that one buffer is queued to
+// the owner and all of the observers.  Writes are non-blocking, so an
+// observer can only fall behind, never hold up the player; one that falls too
+// far behind is told so and detached.
+void Server::Broadcast(Session *session, const std::string &frame) {
+    if (!session->owner && session->observers.empty()) {
+        return;
+    }
+
+    auto bytes = std::make_shared<const std::string>(session->worker->Reader().Frame(frame));
+
+    if (session->owner) {
+        session->owner->QueueShared(bytes);
+    }
+
+    auto &observers = session->observers;
+    for (auto o = observers.begin(); o != observers.end(); ) {
+        Peer *observer = *o;
+        if (observer == session->owner) {
+            ++o;
+            continue;
+        }
+
+        if (observer->PendingBytes() > OBSERVER_BACKLOG_LIMIT) {
+            tracex(1, "observer %d of session %s is too slow", observer->Fd(), session->id.c_str());
+            o = observers.erase(o);
+            Reply(observer, session->id, "observing", json_false());
+            continue;
+        }
+
+        observer->QueueShared(bytes);
+        ++o;
+    }
+}
+
+
+int server_run(const char *socketPath, const std::vector<std::string> &stories) {
+    trace(1, "%s, %d stories", socketPath, stories.size());
+
+    // Snapshots have predictable names, so they don't go straight into a
+    // shared directory like /tmp.  (This has to happen before the preloaders
+    // fork, so that every worker knows the directory.)
+    if (snapshotDir.empty()) {
+        char dir[] = P_tmpdir "/fizmo-json-XXXXXX";
+        if (!mkdtemp(dir)) {
+            fprintf(stderr, "ERROR: unable to create a snapshot directory: %s\n", strerror(errno));
+            return -1;
+        }
+        snapshotDir = dir;
+        tracex(1, "snapshots go in %s", dir);
+    }
+
+    std::vector<Preloader *> preloaders;
+    if (!zygote_preload(stories, &server_session_setup, preloaders)) {
+        return -1;
+    }
+
+    int listener = ipc_listen(socketPath);
+    if (listener < 0) {
+        zygote_unload(preloaders);
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // Resumed sessions are our own children; nobody waits for them.
+    signal(SIGCHLD, SIG_IGN);
+
+    Server server(preloaders);
+    return server.Run(listener);
+}
@@ -0,0 +1,27 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_SERVER_H
+#define FIZMO_JSON_SERVER_H
+
+#include <string>
+#include <vector>
+
+
+// Runs the multi-session server: preloads all of `stories` (see zygote.h),
+// then listens on the unix-domain socket at `socketPath` for newline-delimited
+// JSON messages.  Every message carries a "session" id; the server routes it
+// to that session's worker process (forking a new one the first time it sees
+// the id), and forwards the worker's output, tagged with the same id, back to
+// the connection that most recently spoke for the session (and to any
+// connections observing it).
+// Hibernates sessions to snapshots in `dir` (by default, a new private
+// directory under /tmp) once they have been idle for
+// `idleSeconds`, and hibernates the least-recently-used sessions whenever more
+// than `maxLive` are running or less than `minFreeMb` of memory is available.
+// (A zero disables the corresponding trigger.)  A hibernated session is
+// resumed transparently when its next message arrives.
+extern void server_set_hibernation(const std::string &dir, int idleSeconds, int maxLive, int minFreeMb);
+
+extern int server_run(const char *socketPath, const std::vector<std::string> &stories);
+
+#endif // FIZMO_JSON_SERVER_H
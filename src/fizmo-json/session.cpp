@@ -0,0 +1,101 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "session.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "screen.h"
+#include "story.h"
+#include "util.h"
+
+
+// Shared between the host and the story thread (whose input handler holds
+// on to it).
+struct Session::State {
+    std::mutex              mutex;
+    std::condition_variable ready;
+    std::deque<std::string> inputs;
+    bool                    running = false;
+    bool                    closed = false;
+};
+
+static bool started = false;
+
+
+Session::Session(const std::string &storyfile, OutputHandler handler)
+: storyfile_(storyfile), handler_(handler), state_(std::make_shared<State>()) {
+    trace(2, "[%p] %s", this, storyfile.c_str());
+}
+
+Session::~Session() {
+    trace(2, "[%p]", this);
+    Close();
+}
+
+bool Session::Start() {
+    trace(1, "[%p]", this);
+
+    if (started) {
+        fprintf(stderr, "ERROR: only one session can be started per process\n");
+        return false;
+    }
+    started = true;
+
+    story_init("");
+
+    auto state = state_;
+    screen_set_handlers(handler_, [state](std::string &input) {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->ready.wait(lock, [state] { return !state->inputs.empty() || state->closed; });
+        if (state->inputs.empty()) {
+            return false;
+        }
+        input = state->inputs.front();
+        state->inputs.pop_front();
+        return true;
+    });
+
+    state->running = true;
+    std::string storyfile = storyfile_;
+    thread_ = std::thread([state, storyfile] {
+        story_run(storyfile.c_str());
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->running = false;
+    });
+
+    return true;
+}
+
+void Session::SubmitInput(const std::string &input) {
+    trace(2, "[%p] \"%s\"", this, input.c_str());
+
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->inputs.push_back(input);
+    state_->ready.notify_one();
+}
+
+void Session::Close() {
+    trace(1, "[%p]", this);
+
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->closed = true;
+        state_->ready.notify_one();
+    }
+
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    // (A story ended by Close() never got to say so itself.)
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->running = false;
+}
+
+bool Session::Running() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->running;
+}
@@ -0,0 +1,63 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_SESSION_H
+#define FIZMO_JSON_SESSION_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "buffer.h"
+#include "columns.h"
+
+
+// An in-process fizmo-json session, for hosts that would rather not talk JSON
+// over a pipe.  The story runs on its own thread; each time it waits for
+// input, the output handler is called (on that thread) with the story text
+// and the status window (both as inferred columns and as plain lines), and
+// the story stays blocked until the host calls SubmitInput().
+//
+// The story buffer is handed over untrimmed, and always holds the whole turn;
+// `story.ToJson(true, true)` trims it the way the JSON front-end trims a
+// turn.  (None of the front-end's other options, like partial output,
+// paragraph references or status deltas, apply here.)
+//
+// fizmo keeps all of its state in globals, so there can only ever be one
+// Session per process.
+class Session {
+  public:
+    typedef std::function<void(const Buffer &story, const Columns &columns, const Buffer &lines)> OutputHandler;
+
+    Session(const std::string &storyfile, OutputHandler handler);
+
+    // Closes the session (see Close()).
+    ~Session();
+
+    // Starts the story thread.  Fails if a session has already been started
+    // in this process.
+    bool Start();
+
+    // Queues a line of input (or, when the story wants a single key, the key
+    // or one of the special key names like "enter").
+    void SubmitInput(const std::string &input);
+
+    // Tells the story that there will be no more input, as if its stdin had
+    // been closed, and waits for its thread to finish: once any input already
+    // queued has been read, the thread is ended on the spot (rather than the
+    // whole process, as for a closed stdin).
+    void Close();
+
+    // Whether the story is still running.
+    bool Running() const;
+
+  private:
+    struct State;
+
+    std::string             storyfile_;
+    OutputHandler           handler_;
+    std::shared_ptr<State>  state_;
+    std::thread             thread_;
+};
+
+#endif // FIZMO_JSON_SESSION_H
@@ -0,0 +1,197 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "shmring.h"
+
+#include <algorithm>
+
+extern "C" {
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <limits.h>
+    #include <stdio.h>
+    #include <string.h>
+    #include <unistd.h>
+    #include <linux/futex.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/syscall.h>
+}
+
+#include "util.h"
+
+
+// Not PRIVATE: the other side of the ring is another process.
+static void futex_wait(std::atomic<uint32_t> *addr, uint32_t expected) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(std::atomic<uint32_t> *addr) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+ShmTransport *ShmTransport::Open(const char *name) {
+    trace(1, "%s", name);
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: unable to open shared memory %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    ShmTransport *transport = Adopt(fd);
+    close(fd);
+    return transport;
+}
+
+ShmTransport *ShmTransport::Adopt(int fd) {
+    trace(1, "%d", fd);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ShmHeader)) {
+        fprintf(stderr, "ERROR: shared memory segment is missing or too small\n");
+        return NULL;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "ERROR: unable to map shared memory: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    const ShmHeader *header = (const ShmHeader *)base;
+    const uint32_t capacity = header->capacity;
+    const size_t needed = sizeof(ShmHeader) + 2 * (sizeof(ShmRing) + (size_t)capacity);
+    if (header->magic != SHM_MAGIC || header->version != SHM_VERSION ||
+        capacity == 0 || (capacity & (capacity - 1)) != 0 || (size_t)st.st_size < needed) {
+        fprintf(stderr, "ERROR: shared memory segment isn't a fizmo-json ring\n");
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    return new ShmTransport(base, st.st_size);
+}
+
+ShmTransport::ShmTransport(void *base, size_t size)
+: base_(base), size_(size) {
+    trace(2, "[%p] %p, %d", this, base, size);
+
+    char *p = (char *)base;
+    header_ = (ShmHeader *)p;
+    p += sizeof(ShmHeader);
+    in_ = (ShmRing *)p;
+    p += sizeof(ShmRing);
+    inData_ = p;
+    p += header_->capacity;
+    out_ = (ShmRing *)p;
+    p += sizeof(ShmRing);
+    outData_ = p;
+    mask_ = header_->capacity - 1;
+}
+
+ShmTransport::~ShmTransport() {
+    trace(2, "[%p]", this);
+    munmap(base_, size_);
+}
+
+bool ShmTransport::Read(void *dest, uint32_t len) {
+    char *d = (char *)dest;
+
+    while (len > 0) {
+        const uint32_t tail = in_->tail.load(std::memory_order_relaxed);
+        uint32_t head = in_->head.load(std::memory_order_acquire);
+
+        if (head == tail) {
+            if (header_->closed.load()) {
+                return false;
+            }
+
+            in_->readerWaiting.store(1);
+            head = in_->head.load();
+            if (head == tail && !header_->closed.load()) {
+                futex_wait(&in_->head, head);
+            }
+            in_->readerWaiting.store(0);
+            continue;
+        }
+
+        // Copy what's contiguous, up to what we need.
+        uint32_t available = head - tail;
+        uint32_t offset = tail & mask_;
+        uint32_t chunk = std::min(std::min(available, len), mask_ + 1 - offset);
+        memcpy(d, inData_ + offset, chunk);
+        d += chunk;
+        len -= chunk;
+
+        // (seq_cst, like the flag itself, so that the store can't be
+        // reordered after the load: either the writer sees the space, or we
+        // see that it's waiting.)
+        in_->tail.store(tail + chunk);
+        if (in_->writerWaiting.load()) {
+            futex_wake(&in_->tail);
+        }
+    }
+
+    return true;
+}
+
+bool ShmTransport::Write(const void *src, uint32_t len) {
+    const char *s = (const char *)src;
+
+    while (len > 0) {
+        const uint32_t head = out_->head.load(std::memory_order_relaxed);
+        uint32_t tail = out_->tail.load(std::memory_order_acquire);
+
+        if (head - tail == mask_ + 1) {
+            if (header_->closed.load()) {
+                return false;
+            }
+
+            out_->writerWaiting.store(1);
+            tail = out_->tail.load();
+            if (head - tail == mask_ + 1 && !header_->closed.load()) {
+                futex_wait(&out_->tail, tail);
+            }
+            out_->writerWaiting.store(0);
+            continue;
+        }
+
+        uint32_t space = mask_ + 1 - (head - tail);
+        uint32_t offset = head & mask_;
+        uint32_t chunk = std::min(std::min(space, len), mask_ + 1 - offset);
+        memcpy(outData_ + offset, s, chunk);
+        s += chunk;
+        len -= chunk;
+
+        // (seq_cst for the same reason as in Read().)
+        out_->head.store(head + chunk);
+        if (out_->readerWaiting.load()) {
+            futex_wake(&out_->head);
+        }
+    }
+
+    return true;
+}
+
+bool ShmTransport::ReadMessage(std::string &message) {
+    trace(2, "[%p]", this);
+
+    uint32_t len;
+    if (!Read(&len, sizeof(len))) {
+        return false;
+    }
+    if (len > MAX_FRAMED_MESSAGE) {
+        fprintf(stderr, "ERROR: message length %u is out of bounds\n", len);
+        return false;
+    }
+
+    message.resize(len);
+    return Read(&message[0], len);
+}
+
+bool ShmTransport::WriteFrame(const std::string &frame) {
+    trace(2, "[%p] %d bytes", this, frame.size());
+
+    uint32_t len = frame.size();
+    return Write(&len, sizeof(len)) && Write(frame.data(), len);
+}
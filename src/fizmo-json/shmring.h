@@ -0,0 +1,82 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_SHMRING_H
+#define FIZMO_JSON_SHMRING_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "transport.h"
+
+
+// The shared-memory transport lets a host skip pipes entirely: it creates a
+// segment (with shm_open() or memfd_create()), lays it out as below, and
+// hands it to fizmo-json with --shm or --shm-fd.  The segment holds two
+// single-producer/single-consumer byte rings, one for input (host to us) and
+// one for output (us to the host).
+//
+//   offset 0                   ShmHeader
+//   sizeof(ShmHeader)          ShmRing for input, then `capacity` data bytes
+//   ... + capacity             ShmRing for output, then `capacity` data bytes
+//
+// Each message is a native-endian uint32_t length followed by that many
+// bytes, and may wrap around the end of the data area.  `head` and `tail` are
+// free-running byte counts (modulo 2^32), so the ring holds `head - tail`
+// bytes; `capacity` must be a power of two.  Either side that has to wait sets
+// its "waiting" flag, re-checks, and then sleeps with FUTEX_WAIT on the
+// counter the other side will advance; the other side wakes it (FUTEX_WAKE)
+// whenever it sees the flag set.  Both the counter stores and the flag
+// accesses must be sequentially consistent, or a wakeup can be lost.  The
+// host sets `closed` (and wakes us) to end
+// the session.
+
+const uint32_t SHM_MAGIC = 0x524a5a46;     // "FZJR"
+const uint32_t SHM_VERSION = 1;
+
+struct ShmHeader {
+    uint32_t                magic;
+    uint32_t                version;
+    uint32_t                capacity;
+    std::atomic<uint32_t>   closed;
+};
+
+struct ShmRing {
+    std::atomic<uint32_t>   head;           // advanced by the producer
+    std::atomic<uint32_t>   tail;           // advanced by the consumer
+    std::atomic<uint32_t>   readerWaiting;
+    std::atomic<uint32_t>   writerWaiting;
+    uint32_t                reserved[4];
+};
+
+
+class ShmTransport : public Transport {
+  public:
+    // Maps an existing, host-initialized segment, either by shm_open() name
+    // or from an inherited descriptor.  Returns NULL (after complaining) if
+    // the segment isn't usable.
+    static ShmTransport *Open(const char *name);
+    static ShmTransport *Adopt(int fd);
+
+    ~ShmTransport();
+
+    bool ReadMessage(std::string &message) override;
+    bool WriteFrame(const std::string &frame) override;
+
+  private:
+    ShmTransport(void *base, size_t size);
+
+    bool Read(void *dest, uint32_t len);
+    bool Write(const void *src, uint32_t len);
+
+    void        *base_;
+    size_t      size_;
+    ShmHeader   *header_;
+    ShmRing     *in_;
+    char        *inData_;
+    ShmRing     *out_;
+    char        *outData_;
+    uint32_t    mask_;
+};
+
+#endif // FIZMO_JSON_SHMRING_H
@@ -0,0 +1,163 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "snapshot.h"
+
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+    #include <ctype.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <stdio.h>
+    #include <string.h>
+    #include <unistd.h>
+
+    // fizmo includes...
+    #include <interpreter/fizmo.h>
+    #include <interpreter/savegame.h>
+}
+
+#include "filesys.h"
+#include "screen.h"
+#include "serialize.h"
+#include "util.h"
+
+// "FZJS", so that we don't try to load some random file as our state.
+const uint32_t SNAPSHOT_MAGIC = 0x534a5a46;
+const uint32_t SNAPSHOT_VERSION = 6;
+
+
+// Snapshot files are never opened for writing by name, since the directory
+// may be shared: each is written to a brand-new, private file (which can't
+// be a link someone planted), and then renamed into place.
+static FILE *create_temp(const std::string &path, std::string &temp) {
+    temp = path + ".tmp-" + std::to_string(getpid());
+
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        // Left over from a process that died (and had our pid).
+        unlink(temp.c_str());
+        fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: unable to create %s: %s\n", temp.c_str(), strerror(errno));
+        return NULL;
+    }
+
+    FILE *file = fdopen(fd, "w");
+    if (!file) {
+        close(fd);
+        unlink(temp.c_str());
+    }
+    return file;
+}
+
+// Renames a complete temporary file over `path`, or removes it if it isn't.
+static bool commit_temp(const std::string &temp, const std::string &path, bool ok) {
+    if (ok && rename(temp.c_str(), path.c_str()) == 0) {
+        return true;
+    }
+    unlink(temp.c_str());
+    return false;
+}
+
+static bool write_file(const std::string &path, const std::string &data) {
+    std::string temp;
+    FILE *file = create_temp(path, temp);
+    if (!file) {
+        return false;
+    }
+
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = fclose(file) == 0 && ok;
+    return commit_temp(temp, path, ok);
+}
+
+bool snapshot_save(const std::string &path) {
+    trace(1, "%s", path.c_str());
+
+    std::string savefile = snapshot_story_file(path);
+    std::string temp;
+    FILE *file = create_temp(savefile, temp);
+    z_file *save = file ? filesys_adopt(file, temp.c_str(), FILETYPE_SAVEGAME, FILEACCESS_WRITE) : NULL;
+    if (!save) {
+        fprintf(stderr, "ERROR: unable to write snapshot %s\n", savefile.c_str());
+        if (file) {
+            unlink(temp.c_str());
+        }
+        return false;
+    }
+
+    save_game_to_stream(0, 0, save, false);
+    if (!commit_temp(temp, savefile, bot_filesys.closefile(save) == 0)) {
+        fprintf(stderr, "ERROR: unable to write snapshot %s\n", savefile.c_str());
+        return false;
+    }
+
+    std::ostringstream os;
+    SaveValue(os, SNAPSHOT_MAGIC);
+    SaveValue(os, SNAPSHOT_VERSION);
+    screen_save_state(os);
+
+    if (!os || !write_file(path + ".state", os.str())) {
+        fprintf(stderr, "ERROR: unable to write snapshot %s.state\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool snapshot_load(const std::string &path) {
+    trace(1, "%s", path.c_str());
+
+    std::ifstream is(path + ".state", std::ios::binary);
+    uint32_t magic;
+    uint32_t version;
+    if (!LoadValue(is, magic) || magic != SNAPSHOT_MAGIC ||
+        !LoadValue(is, version) || version != SNAPSHOT_VERSION ||
+        !screen_load_state(is)) {
+        fprintf(stderr, "ERROR: unable to read snapshot %s.state\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+std::string snapshot_story_file(const std::string &path) {
+    return path + ".sav";
+}
+
+static bool copy_file(const std::string &from, const std::string &to) {
+    std::ifstream is(from, std::ios::binary);
+    std::ostringstream os;
+    os << is.rdbuf();
+    return is && os && write_file(to, os.str());
+}
+
+bool snapshot_copy(const std::string &from, const std::string &to) {
+    trace(1, "%s, %s", from.c_str(), to.c_str());
+    return copy_file(snapshot_story_file(from), snapshot_story_file(to)) &&
+        copy_file(from + ".state", to + ".state");
+}
+
+void snapshot_remove(const std::string &path) {
+    trace(1, "%s", path.c_str());
+    unlink(snapshot_story_file(path).c_str());
+    unlink((path + ".state").c_str());
+}
+
+std::string snapshot_file_name(const std::string &id) {
+    static const char hex[] = "0123456789abcdef";
+    std::string name;
+    for (unsigned char ch : id) {
+        if (isalnum(ch) || ch == '-' || ch == '_') {
+            name += ch;
+        } else {
+            name += '%';
+            name += hex[ch >> 4];
+            name += hex[ch & 0x0f];
+        }
+    }
+    return name;
+}
@@ -0,0 +1,33 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_SNAPSHOT_H
+#define FIZMO_JSON_SNAPSHOT_H
+
+#include <string>
+
+// A snapshot is a hibernated session: the Z-machine state, saved by fizmo as
+// a (compressed) Quetzal file at `<path>.sav`, and the front-end's own state
+// -- the pending story buffer, the current format, and the upper window
+// height -- at `<path>.state`.  Snapshots are only ever taken while the story
+// is waiting for input.
+
+// Writes both halves of the snapshot.
+extern bool snapshot_save(const std::string &path);
+
+// Restores the front-end half of the snapshot; the Z-machine half is handed
+// to fizmo as the story's restore file (see snapshot_story_file()).
+extern bool snapshot_load(const std::string &path);
+
+extern std::string snapshot_story_file(const std::string &path);
+
+// Copies both halves of the snapshot at `from` to `to`.
+extern bool snapshot_copy(const std::string &from, const std::string &to);
+
+// Removes both halves of the snapshot.
+extern void snapshot_remove(const std::string &path);
+
+// Turns an arbitrary session id into something that's safe to use as a file
+// name, without letting two different ids collide.
+extern std::string snapshot_file_name(const std::string &id);
+
+#endif // FIZMO_JSON_SNAPSHOT_H
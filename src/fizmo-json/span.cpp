@@ -1,8 +1,13 @@
 // This file is part of fizmo-json.  Please see LICENSE.md for the license.
 
 #include "span.h"
+#include "serialize.h"
 #include "util.h"
 
+Span::Span() {
+    trace(2, "[%p]", this);
+}
+
 Span::Span(const Span &span)
 : format_(span.format_), str_(span.str_) {
     trace(2, "[%p] copy from %p", this, &span);
@@ -70,6 +75,35 @@ json_t* Span::ToJson() const {
     json_object_set_new(obj, "text", json_string(str_.c_str()));
     return obj;
 }
+void Span::WriteJson(DocWriter &writer) const {
+    writer.BeginObject();
+    format_.WriteJsonProps(writer);
+    writer.Key("text");
+    writer.String(str_);
+    writer.EndObject();
+}
+
+const Format &Span::GetFormat() const {
+    return format_;
+}
+
+const std::string &Span::Text() const {
+    return str_;
+}
+
+size_t Span::Bytes() const {
+    return str_.size();
+}
+
+
+void Span::Save(std::ostream &os) const {
+    format_.Save(os);
+    SaveString(os, str_);
+}
+
+bool Span::Load(std::istream &is) {
+    return format_.Load(is) && LoadString(is, str_);
+}
 
 
 std::ostream & operator<<(std::ostream &os, const Span& span) {
@@ -18,6 +18,7 @@ extern "C" {
 // smallest "interesting" piece of text we will ever care about.
 class Span {
   public:
+    Span();
     Span(const Span &span);
 
     // Construct a Span from a fizmo block buffer.  Note that this will *not*
@@ -33,6 +34,17 @@ class Span {
     bool Append(const std::string &str, const Format &format);
 
     json_t* ToJson() const;
+    void WriteJson(DocWriter &writer) const;
+
+    const Format &GetFormat() const;
+    const std::string &Text() const;
+
+    // The size of the span's (UTF-8) text.
+    size_t Bytes() const;
+
+    // Snapshot support...
+    void Save(std::ostream &os) const;
+    bool Load(std::istream &is);
 
     // Debugging helper?  Do we like this, or is the operator overload
     // obnoxious?
@@ -0,0 +1,111 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_SPSCQUEUE_H
+#define FIZMO_JSON_SPSCQUEUE_H
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+extern "C" {
+    #include <errno.h>
+    #include <semaphore.h>
+}
+
+
+// A bounded, lock-free queue for exactly one producer thread and one consumer
+// thread.  The capacity is rounded up to a power of two.
+template <typename T>
+class SpscQueue {
+  public:
+    explicit SpscQueue(size_t capacity)
+    : head_(0), tail_(0) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    bool TryPush(T &&value) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) > mask_) {
+            return false;
+        }
+        slots_[head & mask_] = std::move(value);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T &value) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(slots_[tail & mask_]);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+  private:
+    std::vector<T>      slots_;
+    size_t              mask_;
+
+    // The two ends are written by different threads; keep them off each
+    // other's cache lines.  (Padding rather than alignas(), which C++14's
+    // operator new doesn't honour for heap-allocated queues.)
+    static const size_t CACHE_LINE = 64;
+
+    char                pad0_[CACHE_LINE];
+    std::atomic<size_t> head_;
+    char                pad1_[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail_;
+    char                pad2_[CACHE_LINE - sizeof(std::atomic<size_t>)];
+};
+
+
+// An SpscQueue with blocking ends: a pair of counting semaphores tracks the
+// free and filled slots, so Push() waits while the queue is full (which is
+// the backpressure) and Pop() waits while it's empty.  The queue itself stays
+// lock-free; the semaphores only come into play when one side has to sleep.
+template <typename T>
+class SpscChannel {
+  public:
+    explicit SpscChannel(size_t capacity)
+    : queue_(capacity) {
+        sem_init(&items_, 0, 0);
+        sem_init(&slots_, 0, capacity);
+    }
+
+    ~SpscChannel() {
+        sem_destroy(&items_);
+        sem_destroy(&slots_);
+    }
+
+    void Push(T value) {
+        Wait(&slots_);
+        queue_.TryPush(std::move(value));
+        sem_post(&items_);
+    }
+
+    T Pop() {
+        T value;
+        Wait(&items_);
+        queue_.TryPop(value);
+        sem_post(&slots_);
+        return value;
+    }
+
+  private:
+    static void Wait(sem_t *sem) {
+        while (sem_wait(sem) < 0 && errno == EINTR) {
+        }
+    }
+
+    SpscQueue<T>    queue_;
+    sem_t           items_;
+    sem_t           slots_;
+};
+
+#endif // FIZMO_JSON_SPSCQUEUE_H
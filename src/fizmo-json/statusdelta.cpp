@@ -0,0 +1,130 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "statusdelta.h"
+
+#include "serialize.h"
+#include "util.h"
+
+
+// Frames the client hasn't acknowledged are only remembered for so long.
+static const size_t MAX_UNACKED_VERSIONS = 16;
+
+
+StatusDelta::StatusDelta()
+: haveAcked_(false), next_(1) {
+    trace(2, "[%p]", this);
+}
+
+template <typename T>
+void StatusDelta::Signatures(const std::list<T> &elements, std::vector<std::string> &signatures) {
+    signatures.clear();
+    for (const auto &e : elements) {
+        scratch_.Reset(JSON_COMPACT);
+        e.WriteJson(scratch_);
+        signatures.push_back(scratch_.Str());
+    }
+}
+
+template <typename T>
+void StatusDelta::WriteChanges(DocWriter &writer, const std::list<T> &elements, const std::vector<std::string> &signatures, const std::vector<std::string> &base) {
+    writer.BeginObject();
+    writer.Key("length");
+    writer.Integer(signatures.size());
+    writer.Key("changes");
+    writer.BeginArray();
+    size_t i = 0;
+    for (const auto &e : elements) {
+        if (i >= base.size() || signatures[i] != base[i]) {
+            writer.BeginArray();
+            writer.Integer(i);
+            e.WriteJson(writer);
+            writer.EndArray();
+        }
+        ++i;
+    }
+    writer.EndArray();
+    writer.EndObject();
+}
+
+void StatusDelta::WriteJson(DocWriter &writer, const Columns *columns, const Buffer *lines) {
+    Version current;
+    if (columns) {
+        Signatures(columns->Infos(), current.columns);
+    }
+    if (lines) {
+        Signatures(lines->Paragraphs(), current.lines);
+    }
+
+    // An unchanged status keeps its version (the client may well have
+    // acknowledged it already).
+    const Version *previous = !sent_.empty() ? &sent_.back() : haveAcked_ ? &acked_ : NULL;
+    if (previous && previous->columns == current.columns && previous->lines == current.lines) {
+        current.version = previous->version;
+    } else {
+        current.version = next_++;
+        sent_.push_back(current);
+        if (sent_.size() > MAX_UNACKED_VERSIONS) {
+            sent_.pop_front();
+        }
+    }
+    trace(2, "[%p] version %lld, base %lld", this, current.version, haveAcked_ ? acked_.version : 0);
+
+    writer.BeginObject();
+    writer.Key("version");
+    writer.Integer(current.version);
+
+    if (haveAcked_) {
+        writer.Key("base");
+        writer.Integer(acked_.version);
+    }
+
+    if (columns) {
+        writer.Key("columns");
+        if (haveAcked_) {
+            WriteChanges(writer, columns->Infos(), current.columns, acked_.columns);
+        } else {
+            columns->WriteJson(writer);
+        }
+    }
+
+    if (lines) {
+        writer.Key("lines");
+        if (haveAcked_) {
+            WriteChanges(writer, lines->Paragraphs(), current.lines, acked_.lines);
+        } else {
+            lines->WriteJson(writer);
+        }
+    }
+
+    writer.EndObject();
+}
+
+void StatusDelta::Ack(long long version) {
+    trace(2, "[%p] %lld", this, version);
+
+    while (!sent_.empty() && sent_.front().version < version) {
+        sent_.pop_front();
+    }
+    if (sent_.empty() || sent_.front().version != version) {
+        return;
+    }
+
+    acked_ = std::move(sent_.front());
+    haveAcked_ = true;
+    sent_.pop_front();
+}
+
+void StatusDelta::Resync() {
+    trace(2, "[%p]", this);
+    sent_.clear();
+    haveAcked_ = false;
+}
+
+void StatusDelta::Save(std::ostream &os) const {
+    SaveValue(os, next_);
+}
+
+bool StatusDelta::Load(std::istream &is) {
+    Resync();
+    return LoadValue(is, next_);
+}
@@ -0,0 +1,74 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_STATUSDELTA_H
+#define FIZMO_JSON_STATUSDELTA_H
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "buffer.h"
+#include "columns.h"
+#include "docwriter.h"
+#include "jsonwriter.h"
+
+
+// Status lines hardly ever change (the score and move count tick up, the room
+// name stays put), so rather than resend both views of them every frame, a
+// client can ask for them as changes against the last status it has
+// acknowledged:
+//
+//   "status": { "version": 7, "base": 5,
+//               "columns": { "length": 3, "changes": [ [ 2, {...} ] ] },
+//               "lines": { "length": 1, "changes": [] } }
+//
+// Each element ("columns" entry, or line) at an index in "changes" replaces
+// the one the client has; "length" is the new number of elements.  Frames
+// with no "base" carry the views in full (as they otherwise would be), along
+// with the version.  A status identical to the previous one keeps its
+// version.  Since frames can be based on any acknowledged version, a client
+// keeps each version it has been sent until a frame arrives based on a later
+// one.
+class StatusDelta {
+  public:
+    StatusDelta();
+
+    // Writes the "status" value for the current views (either of which may
+    // be absent), and remembers it as the newest version.
+    void WriteJson(DocWriter &writer, const Columns *columns, const Buffer *lines);
+
+    // The client has applied `version`, so later frames can be based on it.
+    // Acknowledging a version that's no longer (or never was) remembered is
+    // ignored.
+    void Ack(long long version);
+
+    // Forgets what the client has; the next status is sent in full.
+    void Resync();
+
+    // Snapshot support: only the version counter is kept, since a resumed
+    // session starts over with a full status anyway.
+    void Save(std::ostream &os) const;
+    bool Load(std::istream &is);
+
+  private:
+    // A status as sent, as the compact JSON of each element.
+    struct Version {
+        long long                   version;
+        std::vector<std::string>    columns;
+        std::vector<std::string>    lines;
+    };
+
+    template <typename T>
+    void Signatures(const std::list<T> &elements, std::vector<std::string> &signatures);
+
+    template <typename T>
+    void WriteChanges(DocWriter &writer, const std::list<T> &elements, const std::vector<std::string> &signatures, const std::vector<std::string> &base);
+
+    std::deque<Version> sent_;      // not yet acknowledged, oldest first
+    Version             acked_;
+    bool                haveAcked_;
+    long long           next_;
+    JsonWriter          scratch_;
+};
+
+#endif // FIZMO_JSON_STATUSDELTA_H
@@ -0,0 +1,54 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "story.h"
+
+extern "C" {
+    // fizmo includes...
+    #include <interpreter/fizmo.h>
+    #include <interpreter/config.h>
+    #include <tools/filesys.h>  // need this to register filesys... should be better?
+}
+
+#include "screen.h"
+#include "filesys.h"
+#include "util.h"
+
+
+// cast from const char *, because fizmo uses old-school C...
+static bool set_fizmo_config(const char *key, const char *value) {
+    return 0 == set_configuration_value(const_cast<char*>(key), const_cast<char*>(value));
+}
+
+void story_init(const std::string &saveFile) {
+    trace(1, "\"%s\"", saveFile.c_str());
+
+    fizmo_register_filesys_interface(&bot_filesys);
+    tracex(1, "registered filesys");
+
+    // fprintf(stderr, "bot_screen is: %p\n", &bot_screen);
+    int r = fizmo_register_screen_interface(&bot_screen);
+    tracex(1, "register screen result: %d", r);
+
+    // Set config values...
+    set_fizmo_config("disable-external-streams", config_true_value);
+    set_fizmo_config("disable-restore", config_true_value);
+    set_fizmo_config("disable-save", config_true_value);
+    set_fizmo_config("disable-sound", config_true_value);
+
+    set_fizmo_config("autosave-filename", saveFile.c_str());
+    // set_configuration_value("savegame-path", ".");
+}
+
+void story_run(const char *storyfile, const char *restorefile) {
+    trace(1, "%s, %s", storyfile, restorefile ? restorefile : "(NULL)");
+
+    // open a test story file...
+    z_file *story = (&bot_filesys)->openfile(const_cast<char*>(storyfile), FILETYPE_DATA, FILEACCESS_READ);
+
+    z_file *restore = NULL;
+    if (restorefile) {
+        restore = (&bot_filesys)->openfile(const_cast<char*>(restorefile), FILETYPE_SAVEGAME, FILEACCESS_READ);
+    }
+
+    fizmo_start(story, NULL, restore);
+}
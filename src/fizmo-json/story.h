@@ -0,0 +1,17 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_STORY_H
+#define FIZMO_JSON_STORY_H
+
+#include <string>
+
+// Registers our screen and filesys interfaces with fizmo, and sets the
+// configuration that every mode (single story, zygote, ...) shares.  This
+// must be called exactly once, before any story is run.
+extern void story_init(const std::string &saveFile);
+
+// Runs the story, optionally restoring from `restorefile` first.  This only
+// returns once the story has ended.
+extern void story_run(const char *storyfile, const char *restorefile = NULL);
+
+#endif // FIZMO_JSON_STORY_H
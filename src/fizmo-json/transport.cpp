@@ -0,0 +1,384 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "transport.h"
+
+extern "C" {
+    #include <errno.h>
+    #include <poll.h>
+    #include <stdio.h>
+    #include <string.h>
+    #include <unistd.h>
+    #include <sys/uio.h>
+}
+
+#include "cbor.h"
+#include "compress.h"
+#include "ipc.h"
+#include "util.h"
+
+
+Transport::~Transport() {
+}
+
+bool Transport::ReadInput(InputMessage &message) {
+    std::string raw;
+    if (!ReadMessage(raw)) {
+        return false;
+    }
+
+    Decode(raw, message);
+    return true;
+}
+
+void Transport::Decode(const std::string &raw, InputMessage &message) const {
+    message.json = NULL;
+
+    if (encoding_ == ENCODING_CBOR) {
+        message.plain = false;
+        std::string error;
+        message.json = cbor_to_json(raw, error);
+        if (!message.json) {
+            fprintf(stderr, "ERROR with CBOR input: %s\n", error.c_str());
+        }
+        return;
+    }
+
+    message.plain = input_parse_plain(raw.data(), raw.size(), message.input);
+    if (message.plain) {
+        return;
+    }
+
+    json_error_t error;
+    message.json = json_loadb(raw.data(), raw.size(), 0, &error);
+    if (!message.json) {
+        fprintf(stderr, "ERROR with input, line %d, column %d (position %d): %s (%s)\n", error.line, error.column, error.position, error.text, error.source);
+    }
+}
+
+bool Transport::WriteFrameBytes(const char *data, size_t len) {
+    return WriteFrame(std::string(data, len));
+}
+
+size_t Transport::JsonFlags() const {
+    return JSON_COMPACT;
+}
+
+void Transport::Flush() {
+}
+
+int Transport::TakeFd() {
+    return -1;
+}
+
+void Transport::SetEncoding(Encoding encoding) {
+    encoding_ = encoding;
+}
+
+Encoding Transport::GetEncoding() const {
+    return encoding_;
+}
+
+
+FdTransport::FdTransport(int in, int out, bool owned, Framing framing)
+: in_(in), out_(out), owned_(owned), framing_(framing), broken_(false), deflater_(NULL) {
+    trace(2, "[%p] %d, %d, %s, %d", this, in, out, owned ? "owned" : "borrowed", framing);
+}
+
+FdTransport::~FdTransport() {
+    trace(2, "[%p]", this);
+    delete deflater_;
+    for (int fd : fds_) {
+        close(fd);
+    }
+
+    if (owned_) {
+        close(in_);
+        if (out_ != in_) {
+            close(out_);
+        }
+    }
+}
+
+bool FdTransport::ReadMessage(std::string &message) {
+    trace(2, "[%p]", this);
+
+    for (;;) {
+        if (Next(message)) {
+            // Tolerate blank lines between messages.
+            if (!message.empty()) {
+                break;
+            }
+            continue;
+        }
+
+        if (broken_) {
+            return false;
+        }
+
+        ssize_t n = Fill();
+        if (n == 0) {
+            return false;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { in_, POLLIN, 0 };
+                poll(&pfd, 1, -1);
+            } else if (errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool FdTransport::WriteFrame(const std::string &frame) {
+    return WriteFrameBytes(frame.data(), frame.size());
+}
+
+bool FdTransport::WriteFrameBytes(const char *data, size_t len) {
+    trace(2, "[%p] %d bytes", this, len);
+
+    // The frame and its delimiter go out together, without copying the
+    // frame.
+    unsigned char prefix[4];
+    struct iovec iov[3];
+    int count = 0;
+
+    if (framing_ == FRAMING_LENGTH_PREFIXED) {
+        EncodeLength(len, prefix);
+        iov[count++] = { prefix, sizeof(prefix) };
+    }
+    iov[count++] = { (void *)data, len };
+    if (framing_ == FRAMING_NDJSON) {
+        iov[count++] = { (void *)"\n", 1 };
+    }
+
+    // Compressed, the pieces go through the stream in order and come out as
+    // one buffer, flushed so that the frame can be decoded on arrival.
+    if (deflater_) {
+        compressed_.clear();
+        for (int i = 0; i < count; ++i) {
+            if (!deflater_->Compress(iov[i].iov_base, iov[i].iov_len, i == count - 1, compressed_)) {
+                return false;
+            }
+        }
+        iov[0] = { (void *)compressed_.data(), compressed_.size() };
+        count = 1;
+    }
+
+    struct iovec *next = iov;
+
+    while (count > 0) {
+        ssize_t n = writev(out_, next, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { out_, POLLOUT, 0 };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return false;
+        }
+
+        while (count > 0 && (size_t)n >= next->iov_len) {
+            n -= next->iov_len;
+            ++next;
+            --count;
+        }
+        if (count > 0) {
+            next->iov_base = (char *)next->iov_base + n;
+            next->iov_len -= n;
+        }
+    }
+
+    return true;
+}
+
+int FdTransport::TakeFd() {
+    if (fds_.empty()) {
+        return -1;
+    }
+    int fd = fds_.front();
+    fds_.pop_front();
+    return fd;
+}
+
+ssize_t FdTransport::Fill() {
+    char buf[4096];
+    int fds[IPC_MAX_FDS];
+    int nfds = IPC_MAX_FDS;
+
+    // recvmsg() only works on sockets; anything else gets a plain read().
+    ssize_t n = ipc_recv(in_, buf, sizeof(buf), fds, &nfds);
+    if (n < 0 && errno == ENOTSOCK) {
+        nfds = 0;
+        n = read(in_, buf, sizeof(buf));
+    }
+
+    if (n > 0) {
+        pending_.append(buf, n);
+    }
+    fds_.insert(fds_.end(), fds, fds + nfds);
+
+    trace(3, "[%p] read %d bytes, %d descriptors", this, n, nfds);
+    return n;
+}
+
+bool FdTransport::Next(std::string &message) {
+    if (framing_ == FRAMING_LENGTH_PREFIXED) {
+        if (broken_ || pending_.size() < 4) {
+            return false;
+        }
+
+        const unsigned char *p = (const unsigned char *)pending_.data();
+        const size_t len = ((size_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+        if (len > MAX_FRAMED_MESSAGE) {
+            fprintf(stderr, "ERROR: message length %zu is out of bounds\n", len);
+            broken_ = true;
+            return false;
+        }
+        if (pending_.size() < 4 + len) {
+            return false;
+        }
+
+        message.assign(pending_, 4, len);
+        pending_.erase(0, 4 + len);
+        return true;
+    }
+
+    if (broken_) {
+        return false;
+    }
+
+    auto newline = pending_.find('\n');
+    if (newline == std::string::npos) {
+        if (pending_.size() > MAX_FRAMED_MESSAGE) {
+            fprintf(stderr, "ERROR: message of over %zu bytes without a newline\n", pending_.size());
+            broken_ = true;
+        }
+        return false;
+    }
+
+    message.assign(pending_, 0, newline);
+    pending_.erase(0, newline + 1);
+    return true;
+}
+
+void FdTransport::EncodeLength(size_t len, unsigned char *prefix) {
+    prefix[0] = (len >> 24) & 0xFF;
+    prefix[1] = (len >> 16) & 0xFF;
+    prefix[2] = (len >> 8) & 0xFF;
+    prefix[3] = len & 0xFF;
+}
+
+std::string FdTransport::Frame(const std::string &frame) const {
+    if (framing_ == FRAMING_LENGTH_PREFIXED) {
+        unsigned char prefix[4];
+        EncodeLength(frame.size(), prefix);
+        return std::string((const char *)prefix, sizeof(prefix)) + frame;
+    }
+    return frame + "\n";
+}
+
+bool FdTransport::Broken() const {
+    return broken_;
+}
+
+int FdTransport::InFd() const {
+    return in_;
+}
+
+int FdTransport::OutFd() const {
+    return out_;
+}
+
+void FdTransport::SetDeflater(Deflater *deflater) {
+    delete deflater_;
+    deflater_ = deflater;
+}
+
+
+StdioTransport::StdioTransport()
+: eof_(false) {
+    trace(2, "[%p]", this);
+}
+
+StdioTransport::~StdioTransport() {
+    trace(2, "[%p]", this);
+}
+
+bool StdioTransport::ReadMessage(std::string &message) {
+    for (;;) {
+        if (reader_.Next(message)) {
+            return true;
+        }
+
+        if (eof_) {
+            // Running out of input just means that the other end is done.
+            if (reader_.Partial()) {
+                fprintf(stderr, "ERROR with input: incomplete message at end of input\n");
+            }
+            return false;
+        }
+
+        Fill();
+    }
+}
+
+// Waits for input, and then takes everything that's already there, so that
+// pipelined messages are all queued up together.
+void StdioTransport::Fill() {
+    char buf[65536];
+    bool waited = false;
+
+    for (;;) {
+        struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+        int ready = poll(&pfd, 1, waited ? 0 : -1);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            if (ready < 0) {
+                eof_ = true;
+            }
+            return;
+        }
+        waited = true;
+
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (n <= 0) {
+            tracex(1, "end of input");
+            eof_ = true;
+            return;
+        }
+
+        reader_.Append(buf, n);
+        if ((size_t)n < sizeof(buf)) {
+            return;
+        }
+    }
+}
+
+bool StdioTransport::WriteFrame(const std::string &frame) {
+    return WriteFrameBytes(frame.data(), frame.size());
+}
+
+bool StdioTransport::WriteFrameBytes(const char *data, size_t len) {
+    trace(2, "[%p] %d bytes", this, len);
+    fwrite(data, 1, len, stdout);
+    fputc('\n', stdout);
+    return fflush(stdout) == 0;
+}
+
+size_t StdioTransport::JsonFlags() const {
+    return JSON_INDENT(2);
+}
@@ -0,0 +1,166 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_TRANSPORT_H
+#define FIZMO_JSON_TRANSPORT_H
+
+#include <deque>
+#include <string>
+
+extern "C" {
+    #include <sys/types.h>
+    #include <jansson.h>
+}
+
+#include "inputreader.h"
+
+class Deflater;
+
+
+// How messages and frames are encoded: JSON text, or CBOR (RFC 8949) for the
+// same document model.
+enum Encoding {
+    ENCODING_JSON,
+    ENCODING_CBOR,
+};
+
+
+// An input message.  Nearly all of them are just `{"input": "..."}`, which is
+// recognized without building a document at all (`plain`, with the string in
+// `input`); anything else is decoded in full into `json`, which is NULL if the
+// message didn't decode.
+struct InputMessage {
+    bool        plain = false;
+    std::string input;
+    json_t      *json = NULL;
+};
+
+
+// A `Transport` carries whole input messages in, and whole output frames
+// out.  The default stdin/stdout handling doesn't use one; it exists for the
+// modes where a session talks to something other than a terminal.
+class Transport {
+  public:
+    virtual ~Transport();
+
+    // Blocks until a complete message is available.  Returns false once the
+    // other end has gone away.
+    virtual bool ReadMessage(std::string &message) = 0;
+
+    // Like ReadMessage(), but decodes the message (as JSON text, or CBOR) as
+    // well; problems decoding are reported here.
+    virtual bool ReadInput(InputMessage &message);
+
+    virtual bool WriteFrame(const std::string &frame) = 0;
+
+    // Like WriteFrame(), for a frame that isn't in a string (one read back
+    // from the scrollback log, say).  Transports that can write it without
+    // copying it first, do.
+    virtual bool WriteFrameBytes(const char *data, size_t len);
+
+    // The json_dumps() flags for the frames this transport carries.
+    virtual size_t JsonFlags() const;
+
+    // Blocks until every frame written so far has actually gone out.
+    virtual void Flush();
+
+    // Returns (and takes ownership of) the oldest file descriptor that has
+    // arrived alongside the messages, or -1 if there isn't one.
+    virtual int TakeFd();
+
+    // The encoding of both messages and frames; JSON unless set otherwise.
+    virtual void SetEncoding(Encoding encoding);
+    Encoding GetEncoding() const;
+
+  protected:
+    void Decode(const std::string &raw, InputMessage &message) const;
+
+    Encoding encoding_ = ENCODING_JSON;
+};
+
+
+// How messages and frames are delimited on a stream: one per line (which
+// needs compact JSON), or each preceded by its length as a 4-byte big-endian
+// integer.
+enum Framing {
+    FRAMING_NDJSON,
+    FRAMING_LENGTH_PREFIXED,
+};
+
+// Messages are never allowed to claim to be longer than this.
+const size_t MAX_FRAMED_MESSAGE = 16 * 1024 * 1024;
+
+
+// Delimited messages over a pair of file descriptors (which can be the same
+// socket).  Besides the blocking Transport interface, it exposes the pieces
+// that a poll()-driven loop needs: Fill() to read whatever is available, and
+// Next() to pick complete messages out of what's been read.
+class FdTransport : public Transport {
+  public:
+    // When `owned`, the descriptors are closed along with the transport.
+    FdTransport(int in, int out, bool owned = false, Framing framing = FRAMING_NDJSON);
+    ~FdTransport();
+
+    bool ReadMessage(std::string &message) override;
+    bool WriteFrame(const std::string &frame) override;
+    bool WriteFrameBytes(const char *data, size_t len) override;
+    int TakeFd() override;
+
+    // Reads once from the input descriptor; returns what read() does.
+    ssize_t Fill();
+
+    // Extracts the next complete message that has already been read.
+    bool Next(std::string &message);
+
+    // Whether the input has broken the framing (with a message longer than
+    // MAX_FRAMED_MESSAGE), so that nothing more can be read from it.
+    bool Broken() const;
+
+    // Wraps a frame exactly as WriteFrame() would put it on the wire, for
+    // callers that do their own (non-blocking) writing.
+    std::string Frame(const std::string &frame) const;
+
+    int InFd() const;
+    int OutFd() const;
+
+    // Compresses everything WriteFrame() puts on the wire (framing included)
+    // from now on; the transport owns the deflater.
+    void SetDeflater(Deflater *deflater);
+
+  private:
+    static void EncodeLength(size_t len, unsigned char *prefix);
+
+    int             in_;
+    int             out_;
+    bool            owned_;
+    Framing         framing_;
+    bool            broken_;    // a message was too long
+    std::string     pending_;
+    Deflater       *deflater_;
+    std::string     compressed_;
+    std::deque<int> fds_;
+};
+
+
+// The process's own stdin and stdout, which (unlike the other transports)
+// carry pretty-printed JSON, and accept input objects that span lines (or
+// share them).  Input is read straight from the descriptor, taking
+// everything that has already arrived each time, and split into messages
+// incrementally.
+class StdioTransport : public Transport {
+  public:
+    StdioTransport();
+    ~StdioTransport();
+
+    bool ReadMessage(std::string &message) override;
+    bool WriteFrame(const std::string &frame) override;
+    bool WriteFrameBytes(const char *data, size_t len) override;
+    size_t JsonFlags() const override;
+
+  private:
+    void Fill();
+
+    InputReader reader_;
+    bool        eof_;
+};
+
+#endif // FIZMO_JSON_TRANSPORT_H
@@ -57,3 +57,46 @@ std::string ToUtf8(const z_ucs ch) {
 std::u32string FromUtf8(const char *str) {
     return utf8conv.from_bytes(str);
 }
+
+void FromUtf8(const char *str, size_t len, std::u32string &out) {
+    const unsigned char *p = (const unsigned char *)str;
+    const unsigned char *end = p + len;
+
+    out.clear();
+    while (p < end) {
+        char32_t ch = *p++;
+        if (ch < 0x80) {
+            out += ch;
+            continue;
+        }
+
+        int extra;
+        if (ch >= 0xc2 && ch < 0xe0) {
+            extra = 1;
+            ch &= 0x1f;
+        } else if (ch >= 0xe0 && ch < 0xf0) {
+            extra = 2;
+            ch &= 0x0f;
+        } else if (ch >= 0xf0 && ch < 0xf5) {
+            extra = 3;
+            ch &= 0x07;
+        } else {
+            out += (char32_t)0xfffd;
+            continue;
+        }
+
+        int i = 0;
+        while (i < extra && p < end && (*p & 0xc0) == 0x80) {
+            ch = (ch << 6) | (*p++ & 0x3f);
+            ++i;
+        }
+
+        // Overlong forms, surrogates and anything out of range are no better
+        // than truncated sequences.
+        if (i < extra || (extra == 2 && ch < 0x800) || (extra == 3 && ch < 0x10000) ||
+            (ch >= 0xd800 && ch <= 0xdfff) || ch > 0x10ffff) {
+            ch = 0xfffd;
+        }
+        out += ch;
+    }
+}
@@ -28,4 +28,8 @@ std::string ToUtf8(const z_ucs ch);
 
 std::u32string FromUtf8(const char *);
 
+// Decodes into an existing string (reusing its storage), replacing anything
+// that isn't valid UTF-8 with U+FFFD rather than throwing.
+void FromUtf8(const char *str, size_t len, std::u32string &out);
+
 #endif // FIZMO_JSON_UTIL_H
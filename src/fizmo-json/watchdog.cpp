@@ -0,0 +1,101 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "watchdog.h"
+
+#include <algorithm>
+
+extern "C" {
+    #include <pthread.h>
+}
+
+#include "util.h"
+
+
+Watchdog::Watchdog(int wallMs, int cpuMs, ExpiryHandler handler)
+: wallMs_(wallMs), cpuMs_(cpuMs), handler_(handler), armed_(false), stopping_(false), cpuAtArm_(0) {
+    trace(1, "[%p] %d, %d", this, wallMs, cpuMs);
+
+    if (pthread_getcpuclockid(pthread_self(), &cpuClock_) != 0) {
+        cpuClock_ = CLOCK_THREAD_CPUTIME_ID;
+        cpuMs_ = 0;
+    }
+
+    thread_ = std::thread(&Watchdog::Run, this);
+}
+
+Watchdog::~Watchdog() {
+    trace(1, "[%p]", this);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_one();
+    thread_.join();
+}
+
+std::mutex &Watchdog::Mutex() {
+    return mutex_;
+}
+
+long Watchdog::CpuMs() const {
+    struct timespec ts;
+    if (clock_gettime(cpuClock_, &ts) < 0) {
+        return 0;
+    }
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void Watchdog::Arm() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        armed_ = true;
+        armedAt_ = std::chrono::steady_clock::now();
+        cpuAtArm_ = cpuMs_ ? CpuMs() : 0;
+    }
+    cond_.notify_one();
+}
+
+void Watchdog::Disarm() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    armed_ = false;
+}
+
+void Watchdog::Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!stopping_) {
+        if (!armed_) {
+            cond_.wait(lock);
+            continue;
+        }
+
+        // A thread can't use more CPU time than wall-clock time, so sleeping
+        // for the CPU budget that's left never oversleeps it.
+        std::chrono::milliseconds remaining = std::chrono::milliseconds::max();
+
+        if (wallMs_ > 0) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - armedAt_);
+            auto left = std::chrono::milliseconds(wallMs_) - elapsed;
+            if (left.count() <= 0) {
+                handler_("wall", wallMs_);
+                return;
+            }
+            remaining = std::min(remaining, left);
+        }
+
+        if (cpuMs_ > 0) {
+            long left = cpuMs_ - (CpuMs() - cpuAtArm_);
+            if (left <= 0) {
+                handler_("cpu", cpuMs_);
+                return;
+            }
+            remaining = std::min(remaining, std::chrono::milliseconds(left));
+        }
+
+        if (remaining == std::chrono::milliseconds::max()) {
+            cond_.wait(lock);
+        } else {
+            cond_.wait_for(lock, remaining);
+        }
+    }
+}
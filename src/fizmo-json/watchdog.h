@@ -0,0 +1,57 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_WATCHDOG_H
+#define FIZMO_JSON_WATCHDOG_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+extern "C" {
+    #include <time.h>
+}
+
+
+// Bounds how long the interpreter may run between two requests for input.
+// While armed, a background thread watches both the wall-clock time and the
+// CPU time of the thread that armed it; when either passes its budget (a zero
+// budget is unlimited), the expiry handler is called on the watchdog thread,
+// with the mutex held.  The handler is expected not to return.
+//
+// Anything the handler reads (like the screen buffer) should only be changed
+// under Mutex(), so it's never caught half-way through an update.
+class Watchdog {
+  public:
+    typedef std::function<void(const char *budget, int limitMs)> ExpiryHandler;
+
+    // Must be created on the thread whose CPU time is to be watched.
+    Watchdog(int wallMs, int cpuMs, ExpiryHandler handler);
+    ~Watchdog();
+
+    void Arm();
+    void Disarm();
+
+    std::mutex &Mutex();
+
+  private:
+    void Run();
+    long CpuMs() const;
+
+    int                     wallMs_;
+    int                     cpuMs_;
+    ExpiryHandler           handler_;
+    clockid_t               cpuClock_;
+
+    std::mutex              mutex_;
+    std::condition_variable cond_;
+    bool                    armed_;
+    bool                    stopping_;
+    std::chrono::steady_clock::time_point armedAt_;
+    long                    cpuAtArm_;
+
+    std::thread             thread_;
+};
+
+#endif // FIZMO_JSON_WATCHDOG_H
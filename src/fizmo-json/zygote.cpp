@@ -0,0 +1,340 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#include "zygote.h"
+
+#include <map>
+
+extern "C" {
+    #include <errno.h>
+    #include <poll.h>
+    #include <signal.h>
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <string.h>
+    #include <time.h>
+    #include <unistd.h>
+    #include <sys/socket.h>
+}
+
+#include "ipc.h"
+#include "screen.h"
+#include "story.h"
+#include "util.h"
+
+// Spawn requests are tiny JSON objects; anything larger is a mistake.
+const size_t MAX_REQUEST = 4096;
+
+// The client's first line names the story it wants; we don't wait forever
+// for a newline.
+const size_t MAX_HELLO = 1024;
+
+// Every control socket the parent holds, so that each newly-forked preloader
+// can close the ones that belong to its siblings.
+static std::vector<int> controls;
+
+// Only meaningful inside a preloader process...
+static int preloaderControl = -1;
+static SessionSetup preloaderSetup = NULL;
+
+
+// Installed as the first-input hook in a preloader; by the time this is
+// called the story is fully loaded and has produced its opening text.  The
+// preloader never returns from here, but each forked session does, and goes on
+// to generate that opening output and read its first input.
+static void preloader_serve() {
+    trace(1, "");
+
+    // Sessions are never waited on; let the kernel reap them.
+    signal(SIGCHLD, SIG_IGN);
+
+    char buf[MAX_REQUEST];
+    for (;;) {
+        int fds[IPC_MAX_FDS];
+        int nfds = IPC_MAX_FDS;
+        ssize_t n = ipc_recv(preloaderControl, buf, sizeof(buf), fds, &nfds);
+        if (n <= 0) {
+            // Whoever we were preloading for has gone away.
+            tracex(1, "control socket closed, exiting");
+            _exit(0);
+        }
+
+        json_error_t error;
+        json_t *request = json_loadb(buf, n, 0, &error);
+        if (!request) {
+            fprintf(stderr, "ERROR: bad spawn request: %s\n", error.text);
+        } else {
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(preloaderControl);
+                preloaderControl = -1;
+
+                // fizmo seeded the random generator once, in the preloader;
+                // without this, every session would roll the same dice.
+                unsigned seed = (unsigned)time(NULL) ^ ((unsigned)getpid() << 16);
+                srand(seed);
+                srandom(seed);
+                // The setup takes ownership of the descriptors.
+                preloaderSetup(request, fds, nfds);
+                json_decref(request);
+                return;
+            }
+
+            if (pid < 0) {
+                fprintf(stderr, "ERROR: unable to fork session: %s\n", strerror(errno));
+            }
+            tracex(1, "forked session %d", pid);
+        }
+
+        json_decref(request);
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+    }
+}
+
+
+Preloader::Preloader(const std::string &storyfile)
+: storyfile_(storyfile), pid_(-1), control_(-1) {
+    trace(2, "[%p] %s", this, storyfile.c_str());
+}
+
+Preloader::~Preloader() {
+    trace(2, "[%p]", this);
+    if (control_ >= 0) {
+        // The preloader exits as soon as it sees the socket close.
+        close(control_);
+    }
+}
+
+bool Preloader::Start(SessionSetup setup) {
+    trace(1, "[%p] %s", this, storyfile_.c_str());
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        fprintf(stderr, "ERROR: unable to create control socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "ERROR: unable to fork preloader: %s\n", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        close(sv[0]);
+        for (int fd : controls) {
+            close(fd);
+        }
+        controls.clear();
+
+        preloaderControl = sv[1];
+        preloaderSetup = setup;
+        screen_set_first_input_hook(&preloader_serve);
+        story_run(storyfile_.c_str());
+
+        // Either this is a session whose story has ended, or the story ended
+        // before ever asking for input.
+        exit(0);
+    }
+
+    close(sv[1]);
+    controls.push_back(sv[0]);
+    pid_ = pid;
+    control_ = sv[0];
+
+    tracex(1, "preloader for %s is %d", storyfile_.c_str(), pid_);
+    return true;
+}
+
+bool Preloader::Spawn(json_t *request, const int *fds, int nfds) {
+    trace(2, "[%p] %p, %d", this, request, nfds);
+
+    char *payload = json_dumps(request, JSON_COMPACT);
+    if (!payload) {
+        return false;
+    }
+
+    size_t len = strlen(payload);
+    bool sent = len < MAX_REQUEST && ipc_send(control_, payload, len, fds, nfds);
+    free(payload);
+
+    if (!sent) {
+        fprintf(stderr, "ERROR: unable to spawn session for %s\n", storyfile_.c_str());
+    }
+    return sent;
+}
+
+const std::string &Preloader::Story() const {
+    return storyfile_;
+}
+
+bool Preloader::Matches(const char *name) const {
+    return storyfile_ == name || ipc_basename(storyfile_) == name;
+}
+
+
+void zygote_close_controls() {
+    trace(1, "");
+    for (int fd : controls) {
+        close(fd);
+    }
+    controls.clear();
+}
+
+bool zygote_preload(const std::vector<std::string> &stories, SessionSetup setup, std::vector<Preloader *> &preloaders) {
+    trace(1, "%d stories", stories.size());
+
+    for (const auto &story : stories) {
+        auto preloader = new Preloader(story);
+        if (!preloader->Start(setup)) {
+            delete preloader;
+            zygote_unload(preloaders);
+            return false;
+        }
+        preloaders.push_back(preloader);
+    }
+
+    return true;
+}
+
+void zygote_unload(std::vector<Preloader *> &preloaders) {
+    trace(1, "%d preloaders", preloaders.size());
+    for (auto preloader : preloaders) {
+        delete preloader;
+    }
+    preloaders.clear();
+}
+
+Preloader *zygote_find(std::vector<Preloader *> &preloaders, const char *name) {
+    trace(2, "%s", name ? name : "(NULL)");
+
+    if (!name) {
+        return preloaders.size() == 1 ? preloaders.front() : NULL;
+    }
+
+    for (auto preloader : preloaders) {
+        if (preloader->Matches(name)) {
+            return preloader;
+        }
+    }
+
+    return NULL;
+}
+
+
+// In zygote mode, a session simply uses the client connection as its stdin
+// and stdout, and from then on is indistinguishable from a normal,
+// single-story fizmo-json.
+static void zygote_session_setup(json_t *request, const int *fds, int nfds) {
+    trace(1, "%p, %d", request, nfds);
+
+    if (nfds < 1) {
+        fprintf(stderr, "ERROR: spawn request without a connection\n");
+        _exit(1);
+    }
+
+    dup2(fds[0], STDIN_FILENO);
+    dup2(fds[0], STDOUT_FILENO);
+    for (int i = 0; i < nfds; i++) {
+        close(fds[i]);
+    }
+}
+
+// The hello is a single line of JSON, like `{ "story": "curses.z5" }`.
+static void zygote_hello(std::vector<Preloader *> &preloaders, int conn, const std::string &hello) {
+    trace(1, "%d, \"%s\"", conn, hello.c_str());
+
+    json_error_t error;
+    json_t *request = json_loads(hello.c_str(), 0, &error);
+    Preloader *preloader = NULL;
+    if (json_is_object(request)) {
+        preloader = zygote_find(preloaders, json_string_value(json_object_get(request, "story")));
+    }
+
+    if (!preloader || !preloader->Spawn(request, &conn, 1)) {
+        const char *message = "{\"error\":\"unknown story\"}\n";
+        ipc_write_all(conn, message, strlen(message));
+    }
+
+    json_decref(request);
+    close(conn);
+}
+
+int zygote_run(const char *socketPath, const std::vector<std::string> &stories) {
+    trace(1, "%s, %d stories", socketPath, stories.size());
+
+    std::vector<Preloader *> preloaders;
+    if (!zygote_preload(stories, &zygote_session_setup, preloaders)) {
+        return -1;
+    }
+
+    int listener = ipc_listen(socketPath);
+    if (listener < 0) {
+        zygote_unload(preloaders);
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // Connections that haven't yet sent their complete hello line.
+    std::map<int, std::string> pending;
+    std::vector<struct pollfd> fds;
+
+    for (;;) {
+        fds.clear();
+        fds.push_back({ listener, POLLIN, 0 });
+        for (const auto &p : pending) {
+            fds.push_back({ p.first, POLLIN, 0 });
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: poll failed: %s\n", strerror(errno));
+            return -1;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int conn = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+            if (conn >= 0) {
+                tracex(1, "accepted connection %d", conn);
+                pending[conn];
+            }
+        }
+
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (!fds[i].revents) {
+                continue;
+            }
+
+            // Only consume the hello itself; anything after the newline
+            // belongs to the session.
+            int conn = fds[i].fd;
+            char buf[MAX_HELLO];
+            ssize_t n = recv(conn, buf, sizeof(buf), MSG_PEEK);
+            const char *newline = n > 0 ? (const char *)memchr(buf, '\n', n) : NULL;
+            if (n > 0) {
+                n = read(conn, buf, newline ? newline - buf + 1 : n);
+            }
+
+            auto &hello = pending[conn];
+            if (n > 0) {
+                hello.append(buf, n);
+            }
+
+            if (n <= 0 || (!newline && hello.size() >= MAX_HELLO)) {
+                tracex(1, "dropping connection %d", conn);
+                close(conn);
+                pending.erase(conn);
+            } else if (newline) {
+                std::string line = hello;
+                pending.erase(conn);
+                zygote_hello(preloaders, conn, line);
+            }
+        }
+    }
+}
@@ -0,0 +1,71 @@
+// This file is part of fizmo-json.  Please see LICENSE.md for the license.
+
+#ifndef FIZMO_JSON_ZYGOTE_H
+#define FIZMO_JSON_ZYGOTE_H
+
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include <sys/types.h>
+    #include <jansson.h>
+}
+
+
+// Called in each freshly-forked session, with the request that asked for it
+// and any file descriptors that came along.  This is where the session takes
+// over its input and output, just before the story asks for its first input.
+typedef void (*SessionSetup)(json_t *request, const int *fds, int nfds);
+
+// A `Preloader` is a process that has loaded a story and run it up to the
+// point where it first asks for input.  It then sits there, forking a new,
+// ready-to-go session for every spawn request it receives.  Because the
+// session is a copy-on-write fork, it shares the story image (and all of
+// fizmo's setup work) with the preloader.
+class Preloader {
+  public:
+    Preloader(const std::string &storyfile);
+    ~Preloader();
+
+    // Forks the preloader process.  Note that `story_init()` must already
+    // have been called.
+    bool Start(SessionSetup setup);
+
+    // Asks the preloader to fork a new session, handing it `fds`.  The caller
+    // still owns (and should close) its copies of the descriptors.
+    bool Spawn(json_t *request, const int *fds, int nfds);
+
+    const std::string &Story() const;
+
+    // Whether `name` refers to this story, either by the exact path it was
+    // loaded from or by its file name.
+    bool Matches(const char *name) const;
+
+  private:
+    std::string storyfile_;
+    pid_t       pid_;
+    int         control_;
+};
+
+
+// Closes the parent's end of every preloader's control socket.  This is for
+// processes forked from the parent that aren't themselves preloaders.
+extern void zygote_close_controls();
+
+// Starts a preloader for each of `stories`, appending them to `preloaders`.
+// If any of them fails to start, the ones already started are stopped again
+// (see `zygote_unload()`) and this returns false.
+extern bool zygote_preload(const std::vector<std::string> &stories, SessionSetup setup, std::vector<Preloader *> &preloaders);
+
+// Deletes every preloader, which makes their processes exit.
+extern void zygote_unload(std::vector<Preloader *> &preloaders);
+
+// Finds the preloader for `name`; when `name` is NULL, and there's only a
+// single preloader, that one is used.
+extern Preloader *zygote_find(std::vector<Preloader *> &preloaders, const char *name);
+
+// Runs the zygote fork-server: preloads all of `stories`, then listens on the
+// unix-domain socket at `socketPath`, forking a new session per connection.
+extern int zygote_run(const char *socketPath, const std::vector<std::string> &stories);
+
+#endif // FIZMO_JSON_ZYGOTE_H